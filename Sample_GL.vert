@@ -1,22 +1,37 @@
 #version 330 core
 
 // input data : sent from main program
-layout (location = 0) in vec3 vertexPosition;
-layout (location = 1) in vec3 vertexColor;
+// 2D position and RGBA colour (unpacked from 8 bit normalized)
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec4 vertexColor;
 
-uniform mat4 MVP;
+// View * Projection, the same for every object in the frame
+uniform mat4 VP;
+
+// Per-object transforms of this frame, two texels per object : (x, y, scale x, scale y), (cos, sin, -, -) of the angle
+uniform samplerBuffer ObjectTransforms;
+// Slot of this draw's (first) object in ObjectTransforms
+uniform int ObjectBase;
 
 // output data : used by fragment shader
 out vec3 fragColor;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    int slot = ObjectBase + gl_InstanceID;
+    vec4 t = texelFetch(ObjectTransforms, 2*slot);
+    vec2 rotation = texelFetch(ObjectTransforms, 2*slot + 1).xy;
+
+    // Model transform : scale, rotate about z, then translate
+    vec2 p = t.zw * vertexPosition.xy;
+    float c = rotation.x;
+    float s = rotation.y;
+    vec4 v = vec4(c*p.x - s*p.y + t.x, s*p.x + c*p.y + t.y, 0, 1); // Transform an homogeneous 4D vector
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
-    fragColor = vertexColor;
+    fragColor = vertexColor.rgb;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space : VP * M * position
+    gl_Position = VP * v;
 }
@@ -0,0 +1,19 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 atlasCoord;
+in vec3 textColor;
+
+// One channel font atlas : 1 where the glyph is set
+uniform sampler2D Font;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // Bitmap font, no blending : drop the pixels the glyph doesn't cover
+    if (texture(Font, atlasCoord).r < 0.5)
+        discard;
+    color = textColor;
+}
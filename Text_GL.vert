@@ -0,0 +1,31 @@
+#version 330 core
+
+// input data : one unit quad, drawn once per glyph
+// Corner of the quad, (0,0) bottom left to (1,1) top right
+layout (location = 0) in vec2 corner;
+// Per glyph : bottom left corner, then width and height in pixels
+layout (location = 1) in vec4 glyph;
+// Per glyph : RGBA colour (unpacked from 8 bit normalized)
+layout (location = 2) in vec4 glyphColor;
+// Per glyph : the character's cell in the atlas
+layout (location = 3) in float glyphCell;
+
+// 2 / framebuffer size : pixels to clip space
+uniform vec2 ScreenScale;
+// Cells per row and rows of the font atlas
+uniform vec2 AtlasCells;
+
+// output data : used by fragment shader
+out vec2 atlasCoord;
+out vec3 textColor;
+
+void main ()
+{
+    vec2 p = glyph.xy + corner*glyph.zw;
+    gl_Position = vec4(p*ScreenScale - 1.0, 0, 1);
+
+    // Atlas rows are stored top row first
+    vec2 cell = vec2(mod(glyphCell, AtlasCells.x), floor(glyphCell / AtlasCells.x));
+    atlasCoord = (cell + vec2(corner.x, 1.0 - corner.y)) / AtlasCells;
+    textColor = glyphColor.rgb;
+}
@@ -0,0 +1,230 @@
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+
+#include "profiler.h"
+
+/* Heap allocation and GL object creation counters, per frame and per profile
+   zone. GL creations come from gpuResourceCreated (gl_resources.h) and are
+   always counted. Heap allocations are only seen with -DTRACK_ALLOCATIONS,
+   which replaces malloc, calloc, realloc and free and the global operator
+   new/delete, so the GL driver's allocations are counted along with ours;
+   the game build keeps the library allocator untouched.
+   Whatever a frame allocates is charged to the innermost zone open on the
+   allocating thread ("(no zone)" for driver threads), and split by caller :
+   the game's own code, or a shared library (mostly the GL driver, which is
+   free to allocate behind our calls). Once the warmup frames are over the game
+   should neither allocate nor create GL objects : the first frames that do
+   are reported with their zones, and -DALLOCATION_DEBUG aborts on the first one */
+
+#define ALLOCATION_WARMUP_FRAMES 2
+#define ALLOCATION_ZONE_SLOTS 64        // distinct zones tracked, a power of two
+#define ALLOCATION_REPORTED_FRAMES 10   // allocating frames reported in detail
+
+struct AllocationCounters {
+    std::atomic<long long> Allocations;
+    std::atomic<long long> Frees;
+    std::atomic<long long> Bytes;       // requested, over the whole run
+};
+
+AllocationCounters HeapAllocations;
+
+enum AllocationCounter {
+    ALLOC_GAME,             // allocations made by the game's code
+    ALLOC_GAME_BYTES,
+    ALLOC_LIBRARY,          // made inside shared libraries
+    ALLOC_LIBRARY_BYTES,
+    ALLOC_GL_OBJECTS,       // GL objects created
+    ALLOCATION_COUNTERS
+};
+
+/* What one zone did. Zone is claimed once and never released, so the hooks
+   find their slot without locks or allocation */
+struct ZoneAllocations {
+    std::atomic<const char*> Zone;
+    std::atomic<long long> Counts[ALLOCATION_COUNTERS];
+};
+
+struct FrameAllocationTracker {
+    ZoneAllocations Frame[ALLOCATION_ZONE_SLOTS];                   // the frame in progress
+    long long Steady[ALLOCATION_ZONE_SLOTS][ALLOCATION_COUNTERS];   // summed over frames past warmup
+    long Frames;
+    long AllocatingFrames;                                          // past warmup, by the game
+} AllocationTracker;
+
+/* Bounds of the executable's code, from the linker */
+extern "C" char __executable_start, etext;
+
+static const char* noAllocationZone = "(no zone)";
+
+/* Allocations made while this is non zero are not charged to the frame */
+static thread_local int allocationExemptions = 0;
+
+/* Scope whose allocations are expected, e.g. a frame dump or a trace write */
+class AllocationExemption {
+public:
+    AllocationExemption () { allocationExemptions++; }
+    ~AllocationExemption () { allocationExemptions--; }
+    AllocationExemption (const AllocationExemption&) = delete;
+    AllocationExemption& operator= (const AllocationExemption&) = delete;
+};
+
+/* The active zone's slot, claimed on first use. NULL once every slot is taken */
+static ZoneAllocations* zoneAllocations ()
+{
+    const char* zone = profileActiveZone ? profileActiveZone : noAllocationZone;
+    size_t start = ((uintptr_t) zone >> 3) & (ALLOCATION_ZONE_SLOTS - 1);
+    for (size_t i=0; i<ALLOCATION_ZONE_SLOTS; i++) {
+        ZoneAllocations& slot = AllocationTracker.Frame[(start + i) & (ALLOCATION_ZONE_SLOTS - 1)];
+        const char* owner = slot.Zone.load(std::memory_order_acquire);
+        if (!owner && slot.Zone.compare_exchange_strong(owner, zone, std::memory_order_acq_rel))
+            owner = zone;
+        if (owner == zone)
+            return &slot;
+    }
+    return NULL;
+}
+
+/* caller : the return address of malloc & co, tells the game from libraries */
+static inline void trackAllocation (size_t size, const void* caller)
+{
+    HeapAllocations.Allocations.fetch_add(1, std::memory_order_relaxed);
+    HeapAllocations.Bytes.fetch_add(size, std::memory_order_relaxed);
+    if (allocationExemptions)
+        return;
+    ZoneAllocations* slot = zoneAllocations();
+    if (slot) {
+        int game = (const char*) caller >= &__executable_start && (const char*) caller < &etext;
+        slot->Counts[game ? ALLOC_GAME : ALLOC_LIBRARY].fetch_add(1, std::memory_order_relaxed);
+        slot->Counts[game ? ALLOC_GAME_BYTES : ALLOC_LIBRARY_BYTES].fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+static inline void trackFree ()
+{
+    HeapAllocations.Frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+void trackGLObjectCreated ()
+{
+    if (allocationExemptions)
+        return;
+    ZoneAllocations* slot = zoneAllocations();
+    if (slot)
+        slot->Counts[ALLOC_GL_OBJECTS].fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Call once at the end of every frame : closes the frame's counts and checks
+   that the game's part of frames past warmup allocated nothing */
+void endFrameAllocations ()
+{
+    AllocationExemption exempt;     // reporting allocates
+    AllocationTracker.Frames++;
+    long long counts[ALLOCATION_ZONE_SLOTS][ALLOCATION_COUNTERS];
+    long long game = 0;
+    for (int i=0; i<ALLOCATION_ZONE_SLOTS; i++) {
+        for (int k=0; k<ALLOCATION_COUNTERS; k++)
+            counts[i][k] = AllocationTracker.Frame[i].Counts[k].exchange(0, std::memory_order_relaxed);
+        game += counts[i][ALLOC_GAME] + counts[i][ALLOC_GL_OBJECTS];
+    }
+    if (AllocationTracker.Frames <= ALLOCATION_WARMUP_FRAMES)
+        return;
+    for (int i=0; i<ALLOCATION_ZONE_SLOTS; i++)
+        for (int k=0; k<ALLOCATION_COUNTERS; k++)
+            AllocationTracker.Steady[i][k] += counts[i][k];
+    if (!game)
+        return;
+
+    AllocationTracker.AllocatingFrames++;
+    if (AllocationTracker.AllocatingFrames > ALLOCATION_REPORTED_FRAMES)
+        return;
+    fprintf(stderr, "Frame %ld allocated:", AllocationTracker.Frames);
+    for (int i=0; i<ALLOCATION_ZONE_SLOTS; i++)
+        if (counts[i][ALLOC_GAME] || counts[i][ALLOC_GL_OBJECTS])
+            fprintf(stderr, " [%s] %lld allocations (%lld bytes), %lld GL objects;", AllocationTracker.Frame[i].Zone.load(),
+                    counts[i][ALLOC_GAME], counts[i][ALLOC_GAME_BYTES], counts[i][ALLOC_GL_OBJECTS]);
+    fprintf(stderr, "\n");
+#ifdef ALLOCATION_DEBUG
+    abort();
+#endif
+}
+
+void printAllocationSummary ()
+{
+    AllocationExemption exempt;
+    long steady_frames = AllocationTracker.Frames - ALLOCATION_WARMUP_FRAMES;
+#ifdef TRACK_ALLOCATIONS
+    printf("heap: %lld allocations (%lld bytes), %lld frees\n",
+           HeapAllocations.Allocations.load(), HeapAllocations.Bytes.load(), HeapAllocations.Frees.load());
+#endif
+    printf("allocating frames: %ld of %ld after warmup\n", AllocationTracker.AllocatingFrames, steady_frames > 0 ? steady_frames : 0);
+    for (int i=0; i<ALLOCATION_ZONE_SLOTS; i++) {
+        const long long* c = AllocationTracker.Steady[i];
+        if (c[ALLOC_GAME] || c[ALLOC_LIBRARY] || c[ALLOC_GL_OBJECTS])
+            printf("  %-20s game %lld allocations (%lld bytes), libraries %lld (%lld bytes), %lld GL objects\n",
+                   AllocationTracker.Frame[i].Zone.load(), c[ALLOC_GAME], c[ALLOC_GAME_BYTES],
+                   c[ALLOC_LIBRARY], c[ALLOC_LIBRARY_BYTES], c[ALLOC_GL_OBJECTS]);
+    }
+}
+
+#ifdef TRACK_ALLOCATIONS
+
+/* glibc's allocator under its internal names, so our replacements can forward to it */
+extern "C" {
+void* __libc_malloc (size_t size);
+void* __libc_calloc (size_t count, size_t size);
+void* __libc_realloc (void* p, size_t size);
+void __libc_free (void* p);
+
+void* malloc (size_t size)
+{
+    trackAllocation(size, __builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void* calloc (size_t count, size_t size)
+{
+    trackAllocation(count*size, __builtin_return_address(0));
+    return __libc_calloc(count, size);
+}
+
+void* realloc (void* p, size_t size)
+{
+    trackAllocation(size, __builtin_return_address(0));
+    return __libc_realloc(p, size);
+}
+
+void free (void* p)
+{
+    if (!p)
+        return;
+    trackFree();
+    __libc_free(p);
+}
+}
+
+/* Not through malloc : its caller would be this function rather than the code doing new */
+static inline __attribute__((always_inline)) void* trackedAllocate (size_t size, const void* caller)
+{
+    trackAllocation(size, caller);
+    void* p = __libc_malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new (size_t size) { return trackedAllocate(size, __builtin_return_address(0)); }
+void* operator new[] (size_t size) { return trackedAllocate(size, __builtin_return_address(0)); }
+void operator delete (void* p) noexcept { free(p); }
+void operator delete[] (void* p) noexcept { free(p); }
+void operator delete (void* p, size_t) noexcept { free(p); }
+void operator delete[] (void* p, size_t) noexcept { free(p); }
+
+#endif
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "alloc_tracker.h"
+
+/* Scaling benchmark, built as ./bench by make bench. For every scene size it
+   forks a child that sets up a headless context, creates the scene with
+   createScene(bodies) and times a fixed number of ticks : simulate() alone,
+   or the whole draw() with --render. With --generated the scenes are seeded
+   generated levels (level_gen.h) of that many bodies instead of copies of the
+   hand made one. Each child starts from a fresh process,
+   so the game's globals are clean and its peak RSS is its own.
+   The results are printed as JSON.
+   Part of game.cpp's translation unit : included by it when built with -DGAME_BENCH */
+
+#define BENCH_WARMUP_TICKS 20
+
+static const int benchDefaultScenes[] = { 10, 100, 1000, 10000, 100000 };
+
+struct BenchConfig {
+    std::vector<int> Scenes;    // body counts
+    long Ticks;
+    int Render;                 // time draw() (simulation and rendering) instead of simulate()
+    int Width, Height;
+    const char* OutputPath;     // NULL = stdout
+    LevelSpec Level;            // Generate set : generated scenes, with this seed, density and distribution
+};
+
+static void benchUsage (const char* program_name)
+{
+    printf("usage: %s [options]\n", program_name);
+    printf("  --scenes N,N,...     body counts to run (default 10,100,1000,10000,100000)\n");
+    printf("  --ticks N            ticks timed per scene, after %d warmup ticks (default 300)\n", BENCH_WARMUP_TICKS);
+    printf("  --render             time the headless renderer too : draw() and glFinish every tick\n");
+    printf("  --size WxH           framebuffer size with --render (default 1400x1000)\n");
+    printf("  --output PATH        write the JSON report to PATH instead of stdout\n");
+    printf("  --generated          generated levels instead of the tiled hand made one\n");
+    printf("  --seed N             their seed (default 1)\n");
+    printf("  --density F          part of the play area their bodies cover (default 0.08)\n");
+    printf("  --distribution NAME  uniform, clustered or grid (default uniform)\n");
+}
+
+/* One tick as the game runs it */
+static void benchTick (int render)
+{
+    if (!render) {
+        simulate();
+        return;
+    }
+    draw();
+    glFinish();
+    collectGpuTimers();
+}
+
+/* Child side : set up, run and time one scene, write its JSON object to out */
+static void runBenchScene (const BenchConfig& config, int bodies, FILE* out)
+{
+    // initGL and friends print to stdout, keep it for the report
+    if (!freopen("/dev/null", "w", stdout))
+        fprintf(stderr, "Warning: could not silence stdout\n");
+
+    std::chrono::steady_clock::time_point setup_start = std::chrono::steady_clock::now();
+    Options.headless = 1;
+    Options.bodies = bodies;
+    if (config.Level.Generate)
+        Options.level = levelSpecForBodies(bodies, config.Level);
+    width = config.Width;
+    height = config.Height;
+    window = NULL;
+    if (!initHeadless())
+        exit(EXIT_FAILURE);
+    frame_framebuffer = createOffscreenTarget(width, height);
+    initGL(window, width, height);
+    for (int i=0; i<BENCH_WARMUP_TICKS; i++)
+        benchTick(config.Render);
+    double setup = std::chrono::duration<double>(std::chrono::steady_clock::now() - setup_start).count();
+
+    long long allocations = HeapAllocations.Allocations.load();
+    long long bytes = HeapAllocations.Bytes.load();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long i=0; i<config.Ticks; i++)
+        benchTick(config.Render);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    allocations = HeapAllocations.Allocations.load() - allocations;
+    bytes = HeapAllocations.Bytes.load() - bytes;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double ns_per_tick = elapsed*1e9/config.Ticks;
+    fprintf(out, "{\"bodies\": %d, \"render\": %s, \"ticks\": %ld, \"ns_per_tick\": %.1lf, \"ns_per_body\": %.3lf, "
+            "\"allocations\": %lld, \"allocations_per_tick\": %.3lf, \"allocated_bytes\": %lld, "
+            "\"peak_rss_kb\": %ld, \"setup_ms\": %.1lf}",
+            no_objects, config.Render ? "true" : "false", config.Ticks, ns_per_tick, ns_per_tick/no_objects,
+            allocations, (double) allocations/config.Ticks, bytes, usage.ru_maxrss, setup*1000);
+}
+
+/* Parent side : run one scene in a child, returns its JSON object */
+static std::string benchScene (const BenchConfig& config, int bodies)
+{
+    char error[128];
+    int fds[2];
+    if (pipe(fds) != 0) {
+        snprintf(error, sizeof(error), "{\"bodies\": %d, \"error\": \"pipe failed\"}", bodies);
+        return error;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        FILE* out = fdopen(fds[1], "w");
+        runBenchScene(config, bodies, out);
+        fclose(out);
+        _exit(EXIT_SUCCESS);    // no GL teardown, the process is going away
+    }
+    close(fds[1]);
+
+    std::string result;
+    char buffer[512];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+        result.append(buffer, n);
+    close(fds[0]);
+
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || result.empty()) {
+        snprintf(error, sizeof(error), "{\"bodies\": %d, \"error\": \"scene failed\"}", bodies);
+        return error;
+    }
+    return result;
+}
+
+int benchMain (int argc, char** argv)
+{
+    BenchConfig config;
+    config.Scenes.assign(benchDefaultScenes, benchDefaultScenes + sizeof(benchDefaultScenes)/sizeof(benchDefaultScenes[0]));
+    config.Ticks = 300;
+    config.Render = 0;
+    config.Width = width;
+    config.Height = height;
+    config.OutputPath = NULL;
+    config.Level = LEVEL_DEFAULT_SPEC;
+
+    for (int i=1; i<argc; i++) {
+        const char* arg = argv[i];
+        int has_value = i+1 < argc;
+        if (!strcmp(arg, "--scenes") && has_value) {
+            config.Scenes.clear();
+            for (const char* p = argv[++i]; *p; p = strchr(p, ',') ? strchr(p, ',') + 1 : p + strlen(p))
+                config.Scenes.push_back(max(atoi(p), 1));
+        }
+        else if (!strcmp(arg, "--ticks") && has_value)
+            config.Ticks = max(atol(argv[++i]), 1L);
+        else if (!strcmp(arg, "--render"))
+            config.Render = 1;
+        else if (!strcmp(arg, "--size") && has_value && sscanf(argv[i+1], "%dx%d", &config.Width, &config.Height) == 2)
+            i++;
+        else if (!strcmp(arg, "--output") && has_value)
+            config.OutputPath = argv[++i];
+        else if (!strcmp(arg, "--generated"))
+            config.Level.Generate = 1;
+        else if (!strcmp(arg, "--seed") && has_value)
+            config.Level.Seed = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(arg, "--density") && has_value)
+            config.Level.Density = min(max(atof(argv[++i]), 0.001), 1.0);
+        else if (!strcmp(arg, "--distribution") && has_value && parseLevelDistribution(argv[i+1]) >= 0)
+            config.Level.Distribution = (LevelDistribution) parseLevelDistribution(argv[++i]);
+        else {
+            benchUsage(argv[0]);
+            return strcmp(arg, "--help") ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+
+    FILE* out = config.OutputPath ? fopen(config.OutputPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Error: could not write %s\n", config.OutputPath);
+        return EXIT_FAILURE;
+    }
+    int failed = 0;
+    fprintf(out, "{\"benchmark\": \"scaling\", \"ticks\": %ld, \"warmup_ticks\": %d, \"render\": %s, \"size\": \"%dx%d\", ",
+            config.Ticks, BENCH_WARMUP_TICKS, config.Render ? "true" : "false", config.Width, config.Height);
+    if (config.Level.Generate)
+        fprintf(out, "\"level\": {\"seed\": %u, \"density\": %.4lf, \"distribution\": \"%s\"}, ", config.Level.Seed,
+                config.Level.Density, levelDistributionNames[config.Level.Distribution]);
+    fprintf(out, "\"scenes\": [\n");
+    for (size_t i=0; i<config.Scenes.size(); i++) {
+        std::string scene = benchScene(config, config.Scenes[i]);
+        failed |= scene.find("\"error\"") != std::string::npos;
+        fprintf(out, "  %s%s\n", scene.c_str(), i+1 < config.Scenes.size() ? "," : "");
+        fflush(out);
+        if (config.OutputPath)
+            fprintf(stderr, "%s\n", scene.c_str());
+    }
+    fprintf(out, "]}\n");
+    if (config.OutputPath)
+        fclose(out);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
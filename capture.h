@@ -0,0 +1,258 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+#include "headless.h"
+#include "profiler.h"
+
+/* Video capture that never waits for the GPU : every frame is read into one of
+   a ring of pixel buffer objects, and mapped Depth frames later when the copy
+   has long finished. A worker thread converts and writes the pixels, to a
+   .y4m file (YUV 4:2:0) or to a directory of PPM images. A .y4m stream has a
+   single frame size, so it ends when the frame is resized; a PPM sequence
+   starts over at the new size and goes on numbering its files */
+
+#define CAPTURE_MAX_QUEUED 8    // frames waiting for the writer before we start dropping
+
+struct FrameCapture {
+    int Active;
+    int Y4M;                            // 1 : one .y4m stream, 0 : PPM sequence in a directory
+    std::string Path;
+    FILE* File;
+    int Width, Height;
+    int Fps;
+    int Depth;                          // frames between readback and mapping
+    long long FirstIndex;               // PPM sequences : number of the first file, after a resize
+
+    std::vector<GLBuffer> PixelBuffers; // ring of Depth PBOs
+    std::vector<GLsync> Fences;
+    long long Issued;                   // frames read into a PBO
+    long long Queued;                   // frames handed to the writer
+    long long Written;                  // frames written out (writer thread)
+    long long Dropped;                  // frames lost because the writer fell behind
+
+    std::thread Writer;
+    std::mutex Lock;
+    std::condition_variable Wake;
+    std::deque< std::vector<unsigned char> > Pending;   // RGBA frames, bottom row first
+    std::vector< std::vector<unsigned char> > Free;     // recycled frame buffers
+    int Stopping;
+} Capture;
+
+/* Write one RGBA frame (bottom row first) as a Y4M frame, BT.601 full range */
+static void writeY4MFrame (FILE* file, const unsigned char* rgba, int width, int height, std::vector<unsigned char>& yuv)
+{
+    int cw = (width+1)/2, ch = (height+1)/2;
+    yuv.resize((size_t) width*height + 2*(size_t) cw*ch);
+    unsigned char* Y = &yuv[0];
+    unsigned char* U = Y + (size_t) width*height;
+    unsigned char* V = U + (size_t) cw*ch;
+
+    for (int y=0; y<height; y++) {
+        const unsigned char* row = rgba + (size_t) (height-1-y)*width*4;
+        for (int x=0; x<width; x++) {
+            const unsigned char* p = row + 4*x;
+            Y[(size_t) y*width + x] = (unsigned char) (0.299f*p[0] + 0.587f*p[1] + 0.114f*p[2] + 0.5f);
+        }
+    }
+    // One chroma sample per 2x2 block, from the block's top left pixel
+    for (int y=0; y<ch; y++) {
+        const unsigned char* row = rgba + (size_t) (height-1-2*y)*width*4;
+        for (int x=0; x<cw; x++) {
+            const unsigned char* p = row + 8*x;
+            U[(size_t) y*cw + x] = (unsigned char) (128.5f - 0.168736f*p[0] - 0.331264f*p[1] + 0.5f*p[2]);
+            V[(size_t) y*cw + x] = (unsigned char) (128.5f + 0.5f*p[0] - 0.418688f*p[1] - 0.081312f*p[2]);
+        }
+    }
+
+    fputs("FRAME\n", file);
+    fwrite(&yuv[0], 1, yuv.size(), file);
+}
+
+static void captureWriterLoop ()
+{
+    setProfileThreadName("capture writer");
+    std::vector<unsigned char> converted;
+    long long index = Capture.FirstIndex;
+    for (;;) {
+        std::vector<unsigned char> frame;
+        {
+            std::unique_lock<std::mutex> lock(Capture.Lock);
+            while (Capture.Pending.empty() && !Capture.Stopping)
+                Capture.Wake.wait(lock);
+            if (Capture.Pending.empty())
+                return;
+            frame.swap(Capture.Pending.front());
+            Capture.Pending.pop_front();
+        }
+
+        PROFILE_ZONE("capture write");
+        if (Capture.Y4M)
+            writeY4MFrame(Capture.File, &frame[0], Capture.Width, Capture.Height, converted);
+        else {
+            converted.resize((size_t) Capture.Width*Capture.Height*3);
+            for (size_t i=0, n=(size_t) Capture.Width*Capture.Height; i<n; i++)
+                memcpy(&converted[3*i], &frame[4*i], 3);
+            char name[64];
+            snprintf(name, sizeof(name), "/capture_%06lld.ppm", index);
+            writePPM((Capture.Path + name).c_str(), &converted[0], Capture.Width, Capture.Height);
+        }
+        index++;
+
+        std::lock_guard<std::mutex> lock(Capture.Lock);
+        Capture.Written++;
+        Capture.Free.push_back(std::vector<unsigned char>());
+        Capture.Free.back().swap(frame);
+    }
+}
+
+/* Start capturing width x height frames to path : a .y4m file, or else a directory of PPMs
+   numbered from first */
+int startCapture (const char* path, int width, int height, int fps, int depth, long long first=0)
+{
+    Capture.Path = path;
+    Capture.Y4M = Capture.Path.size() > 4 && Capture.Path.compare(Capture.Path.size()-4, 4, ".y4m") == 0;
+    Capture.Width = width;
+    Capture.Height = height;
+    Capture.Fps = fps;
+    Capture.Depth = depth < 1 ? 1 : depth;
+    Capture.FirstIndex = first;
+    Capture.Issued = Capture.Queued = Capture.Written = Capture.Dropped = 0;
+    Capture.Stopping = 0;
+    Capture.File = NULL;
+
+    if (Capture.Y4M) {
+        Capture.File = fopen(path, "wb");
+        if (!Capture.File) {
+            fprintf(stderr, "Error: could not open %s for capture\n", path);
+            return 0;
+        }
+        fprintf(Capture.File, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+    }
+    else
+        mkdir(path, 0755);
+
+    GLsizeiptr frame_size = (GLsizeiptr) width*height*4;
+    Capture.PixelBuffers.clear();
+    for (int i=0; i<Capture.Depth; i++) {
+        Capture.PixelBuffers.push_back(GLBuffer::generate());
+        bufferData(Capture.PixelBuffers.back(), GL_PIXEL_PACK_BUFFER, frame_size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    Capture.Fences.assign(Capture.Depth, (GLsync) 0);
+
+    // Enough frame buffers for the in-flight frames, so capturing doesn't allocate
+    Capture.Free.assign(CAPTURE_MAX_QUEUED + 1, std::vector<unsigned char>(frame_size));
+
+    Capture.Writer = std::thread(captureWriterLoop);
+    Capture.Active = 1;
+    return 1;
+}
+
+/* Map the PBO in slot, and hand its pixels to the writer thread */
+static void retireCaptureSlot (int slot)
+{
+    glClientWaitSync(Capture.Fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(Capture.Fences[slot]);
+    Capture.Fences[slot] = 0;
+
+    std::vector<unsigned char> frame;
+    {
+        std::lock_guard<std::mutex> lock(Capture.Lock);
+        if (Capture.Pending.size() >= CAPTURE_MAX_QUEUED || Capture.Free.empty()) {
+            Capture.Dropped++;
+            return;
+        }
+        frame.swap(Capture.Free.back());
+        Capture.Free.pop_back();
+    }
+
+    size_t frame_size = (size_t) Capture.Width*Capture.Height*4;
+    frame.resize(frame_size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, Capture.PixelBuffers[slot].get());
+    void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame_size, GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(&frame[0], pixels, frame_size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    std::lock_guard<std::mutex> lock(Capture.Lock);
+    Capture.Pending.push_back(std::vector<unsigned char>());
+    Capture.Pending.back().swap(frame);
+    Capture.Queued++;
+    Capture.Wake.notify_one();
+}
+
+void stopCapture ();
+
+/* Call once per frame, after drawing and before swapping buffers, with the frame's size */
+void captureFrame (GLuint framebuffer, int width, int height)
+{
+    if (!Capture.Active)
+        return;
+
+    // The ring and the output are sized for the frame the capture started with
+    if (width != Capture.Width || height != Capture.Height) {
+        std::string path = Capture.Path;
+        int y4m = Capture.Y4M, fps = Capture.Fps, depth = Capture.Depth;
+        printf("capture: the frame went from %dx%d to %dx%d\n", Capture.Width, Capture.Height, width, height);
+        stopCapture();
+        if (y4m || !startCapture(path.c_str(), width, height, fps, depth, Capture.FirstIndex + Capture.Written))
+            return;
+    }
+
+    // The slot we are about to reuse was filled Depth frames ago, its copy is done by now
+    int slot = Capture.Issued % Capture.Depth;
+    if (Capture.Fences[slot])
+        retireCaptureSlot(slot);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, Capture.PixelBuffers[slot].get());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, Capture.Width, Capture.Height, GL_RGBA, GL_UNSIGNED_BYTE, 0);   // asynchronous into the PBO
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    Capture.Fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    Capture.Issued++;
+}
+
+/* Flush the frames still in flight, wait for the writer and close the output */
+void stopCapture ()
+{
+    if (!Capture.Active)
+        return;
+
+    for (long long i = Capture.Issued - Capture.Depth; i < Capture.Issued; i++) {
+        if (i < 0)
+            continue;
+        int slot = i % Capture.Depth;
+        if (Capture.Fences[slot])
+            retireCaptureSlot(slot);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(Capture.Lock);
+        Capture.Stopping = 1;
+        Capture.Wake.notify_one();
+    }
+    Capture.Writer.join();
+    if (Capture.File)
+        fclose(Capture.File);
+    Capture.PixelBuffers.clear();
+    Capture.Active = 0;
+
+    printf("capture: %lld frames written to %s, %lld dropped\n", Capture.Written, Capture.Path.c_str(), Capture.Dropped);
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <math.h>
+
+/* The hit tests of collision(), as plain functions of the ball and one body so
+   they can be measured on their own (collision_bench.cpp). Each returns 1 on a
+   hit; what a hit does to the ball stays in collision().
+   The ball is (x, y, radius). Rectangles are given by their bottom left corner
+   (rx, ry) and length x width, every rectangle test takes the same arguments
+   whether it uses them or not; circular bodies by their centre and radius */
+
+/* Ball resting on or falling onto the top of the rectangle */
+static inline int hitsRectangleTop (double x, double y, double radius, double rx, double ry, double length, double width)
+{
+    return fabs(ry - y) <= radius + width && x + radius > rx && x - radius <= rx + length && y > ry;
+}
+
+/* Ball rising into the rectangle's underside */
+static inline int hitsRectangleBottom (double x, double y, double radius, double rx, double ry, double length, double /*width*/)
+{
+    return ry > y && fabs(ry - y) <= radius && x + radius > rx && x - radius <= rx + length;
+}
+
+/* Ball coming from the left into the rectangle's left side */
+static inline int hitsRectangleLeft (double x, double y, double radius, double rx, double ry, double /*length*/, double width)
+{
+    return x < rx && rx - x <= radius && y <= ry + width && y >= ry;
+}
+
+/* Ball coming from the right into the rectangle's right side */
+static inline int hitsRectangleRight (double x, double y, double radius, double rx, double ry, double length, double width)
+{
+    return x > rx && x - rx <= radius + length && y <= ry + width && y >= ry;
+}
+
+/* Ball overlapping a circular body : a target, or an obstacle's bounding circle */
+static inline int hitsCircle (double x, double y, double radius, double cx, double cy, double body_radius)
+{
+    double dist = sqrt((cy-y)*(cy-y) + (cx-x)*(cx-x));
+    return dist < radius + body_radius;
+}
+
+#endif
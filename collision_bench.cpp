@@ -0,0 +1,231 @@
+/* Microbenchmark of the collision() hit tests (collision.h), no window or GL needed.
+   Every kernel runs over ball/body pairs drawn from synthetic distributions;
+   after warmup repetitions each repetition times one pass over all the pairs,
+   and the report gives the min, median and p99 time per test.
+   Build with make collision_bench. To measure a new variant (SIMD, broadphase),
+   add a KernelCase to the kernels table */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "collision.h"
+
+#define BENCH_PAIRS 4096            // fits in L2 : measures the test, not memory
+#define BENCH_WARMUP_REPS 20
+#define BENCH_REPS 200
+#define BENCH_SEED 1234
+
+/* Ball/body pairs, structure of arrays. Circular bodies keep their radius in Length */
+struct Pairs {
+    std::vector<double> X, Y, Radius;               // ball
+    std::vector<double> BodyX, BodyY, Length, Width;  // body
+    size_t size () const { return X.size(); }
+};
+
+typedef int (*HitTest) (const Pairs& pairs, size_t i);
+
+template <int (*Test) (double, double, double, double, double, double, double)>
+int rectangleTest (const Pairs& p, size_t i)
+{
+    return Test(p.X[i], p.Y[i], p.Radius[i], p.BodyX[i], p.BodyY[i], p.Length[i], p.Width[i]);
+}
+
+int circleTest (const Pairs& p, size_t i)
+{
+    return hitsCircle(p.X[i], p.Y[i], p.Radius[i], p.BodyX[i], p.BodyY[i], p.Length[i]);
+}
+
+/* One timed pass over all the pairs; the hit count keeps the work alive */
+template <HitTest Test>
+long runPass (const Pairs& pairs)
+{
+    long hits = 0;
+    for (size_t i=0; i<pairs.size(); i++)
+        hits += Test(pairs, i);
+    return hits;
+}
+
+enum BodyShape { SHAPE_RECTANGLE, SHAPE_TARGET, SHAPE_OBSTACLE };
+
+struct KernelCase {
+    const char* Name;
+    BodyShape Shape;                // what the bodies look like
+    HitTest Test;                   // the kernel, to sort pairs into hits and misses
+    long (*Run) (const Pairs&);     // the kernel, inlined into the timed loop
+};
+
+static const KernelCase kernels[] = {
+    { "rectangle top",    SHAPE_RECTANGLE, rectangleTest<hitsRectangleTop>,    runPass< rectangleTest<hitsRectangleTop> > },
+    { "rectangle bottom", SHAPE_RECTANGLE, rectangleTest<hitsRectangleBottom>, runPass< rectangleTest<hitsRectangleBottom> > },
+    { "rectangle left",   SHAPE_RECTANGLE, rectangleTest<hitsRectangleLeft>,   runPass< rectangleTest<hitsRectangleLeft> > },
+    { "rectangle right",  SHAPE_RECTANGLE, rectangleTest<hitsRectangleRight>,  runPass< rectangleTest<hitsRectangleRight> > },
+    { "target",           SHAPE_TARGET,    circleTest,                         runPass<circleTest> },
+    { "obstacle",         SHAPE_OBSTACLE,  circleTest,                         runPass<circleTest> },
+};
+
+enum Distribution { UNIFORM, CLUSTERED, ALL_MISS, ALL_HIT, DISTRIBUTIONS };
+static const char* distributionNames[DISTRIBUTIONS] = { "uniform", "clustered", "all-miss", "all-hit" };
+
+/* Body sizes as the level uses them */
+static void randomBody (BodyShape shape, std::mt19937& rng, double& length, double& width)
+{
+    std::uniform_real_distribution<double> unit (0, 1);
+    if (shape == SHAPE_RECTANGLE) {
+        length = 1;
+        width = 0.4 + 0.1*(unit(rng) < 0.5);
+    }
+    else {
+        length = shape == SHAPE_TARGET ? (unit(rng) < 0.5 ? 0.1 : 0.2) : 0.2;
+        width = 0;
+    }
+}
+
+/* Fill pairs with count ball/body pairs from distribution.
+   uniform : ball and body anywhere in the view. clustered : both near one of a
+   few cluster centres, as bodies bunched where the ball flies. all-miss and
+   all-hit : pairs near each other, kept only if the kernel misses / hits */
+static void makePairs (const KernelCase& kernel, Distribution distribution, size_t count, std::mt19937& rng, Pairs& pairs)
+{
+    std::uniform_real_distribution<double> view (-4, 4), near (-0.6, 0.6);
+    std::normal_distribution<double> spread (0, 0.3);
+    double clusters[4][2] = { {-2, -2}, {0, 1}, {2, -1}, {-1, 2.5} };
+
+    pairs = Pairs();
+    Pairs candidate;
+    candidate.X.resize(1); candidate.Y.resize(1); candidate.Radius.resize(1);
+    candidate.BodyX.resize(1); candidate.BodyY.resize(1); candidate.Length.resize(1); candidate.Width.resize(1);
+    while (pairs.size() < count) {
+        double& x = candidate.X[0];
+        double& y = candidate.Y[0];
+        candidate.Radius[0] = 0.2;      // the ball's collision radius
+        randomBody(kernel.Shape, rng, candidate.Length[0], candidate.Width[0]);
+        if (distribution == UNIFORM) {
+            x = view(rng);
+            y = view(rng);
+            candidate.BodyX[0] = view(rng);
+            candidate.BodyY[0] = view(rng);
+        }
+        else if (distribution == CLUSTERED) {
+            const double* c = clusters[rng() % 4];
+            x = c[0] + spread(rng);
+            y = c[1] + spread(rng);
+            candidate.BodyX[0] = c[0] + spread(rng);
+            candidate.BodyY[0] = c[1] + spread(rng);
+        }
+        else {
+            // Rectangles are anchored at a corner : aim near the middle of them
+            x = view(rng);
+            y = view(rng);
+            candidate.BodyX[0] = x + near(rng) - candidate.Length[0]/2*(kernel.Shape == SHAPE_RECTANGLE);
+            candidate.BodyY[0] = y + near(rng) - candidate.Width[0]/2;
+            if (kernel.Test(candidate, 0) != (distribution == ALL_HIT))
+                continue;
+        }
+        pairs.X.push_back(x);
+        pairs.Y.push_back(y);
+        pairs.Radius.push_back(candidate.Radius[0]);
+        pairs.BodyX.push_back(candidate.BodyX[0]);
+        pairs.BodyY.push_back(candidate.BodyY[0]);
+        pairs.Length.push_back(candidate.Length[0]);
+        pairs.Width.push_back(candidate.Width[0]);
+    }
+}
+
+static double percentile (const std::vector<double>& sorted, double p)
+{
+    return sorted[(size_t) (p/100.0*(sorted.size()-1) + 0.5)];
+}
+
+struct CaseResult {
+    double Min, Median, P99;    // ns per test
+    double HitRate;
+};
+
+static CaseResult measure (const KernelCase& kernel, const Pairs& pairs, int reps)
+{
+    volatile long sink = 0;
+    for (int r=0; r<BENCH_WARMUP_REPS; r++)
+        sink = sink + kernel.Run(pairs);
+
+    std::vector<double> times (reps);
+    long hits = 0;
+    for (int r=0; r<reps; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        hits = kernel.Run(pairs);
+        times[r] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()/pairs.size();
+        sink = sink + hits;
+    }
+    std::sort(times.begin(), times.end());
+    CaseResult result = { times.front(), percentile(times, 50), percentile(times, 99), (double) hits/pairs.size() };
+    return result;
+}
+
+static void usage (const char* program_name)
+{
+    printf("usage: %s [options]\n", program_name);
+    printf("  --pairs N      ball/body pairs per pass (default %d)\n", BENCH_PAIRS);
+    printf("  --reps N       timed passes per case, after %d warmup passes (default %d)\n", BENCH_WARMUP_REPS, BENCH_REPS);
+    printf("  --seed N       seed of the synthetic data (default %d)\n", BENCH_SEED);
+    printf("  --kernel NAME  only run kernels whose name contains NAME\n");
+    printf("  --json         print JSON instead of a table\n");
+}
+
+int main (int argc, char** argv)
+{
+    size_t count = BENCH_PAIRS;
+    int reps = BENCH_REPS;
+    unsigned seed = BENCH_SEED;
+    const char* filter = NULL;
+    int json = 0;
+    for (int i=1; i<argc; i++) {
+        const char* arg = argv[i];
+        int has_value = i+1 < argc;
+        if (!strcmp(arg, "--pairs") && has_value)
+            count = std::max(atol(argv[++i]), 1L);
+        else if (!strcmp(arg, "--reps") && has_value)
+            reps = std::max(atoi(argv[++i]), 1);
+        else if (!strcmp(arg, "--seed") && has_value)
+            seed = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(arg, "--kernel") && has_value)
+            filter = argv[++i];
+        else if (!strcmp(arg, "--json"))
+            json = 1;
+        else {
+            usage(argv[0]);
+            return strcmp(arg, "--help") ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+    }
+
+    if (json)
+        printf("{\"benchmark\": \"collision\", \"pairs\": %ld, \"reps\": %d, \"seed\": %u, \"cases\": [", (long) count, reps, seed);
+    else
+        printf("%-18s %-10s %9s %9s %9s %7s   (ns per test, %ld pairs, %d reps)\n",
+               "kernel", "data", "min", "median", "p99", "hits", (long) count, reps);
+    int first = 1;
+    for (size_t k=0; k<sizeof(kernels)/sizeof(kernels[0]); k++) {
+        if (filter && !strstr(kernels[k].Name, filter))
+            continue;
+        for (int d=0; d<DISTRIBUTIONS; d++) {
+            std::mt19937 rng (seed + 1000*k + d);   // same data whatever the filter
+            Pairs pairs;
+            makePairs(kernels[k], (Distribution) d, count, rng, pairs);
+            CaseResult r = measure(kernels[k], pairs, reps);
+            if (json)
+                printf("%s\n  {\"kernel\": \"%s\", \"data\": \"%s\", \"min_ns\": %.4lf, \"median_ns\": %.4lf, \"p99_ns\": %.4lf, \"hit_rate\": %.4lf}",
+                       first ? "" : ",", kernels[k].Name, distributionNames[d], r.Min, r.Median, r.P99, r.HitRate);
+            else
+                printf("%-18s %-10s %9.3lf %9.3lf %9.3lf %6.1lf%%\n",
+                       kernels[k].Name, distributionNames[d], r.Min, r.Median, r.P99, 100*r.HitRate);
+            first = 0;
+        }
+    }
+    if (json)
+        printf("\n]}\n");
+    return EXIT_SUCCESS;
+}
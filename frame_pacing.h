@@ -0,0 +1,190 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <GLFW/glfw3.h>
+
+/* How frames are paced : the swap interval (vsync off, on, or adaptive, which
+   tears instead of waiting when a frame is late) and an optional frame limiter
+   that sleeps most of the way to the next frame and spins for the rest.
+   Frame times are recorded so a run can end with a timing summary */
+
+enum VsyncMode {
+    VSYNC_OFF,
+    VSYNC_ON,
+    VSYNC_ADAPTIVE
+};
+
+static const char* vsyncModeNames[] = { "off", "on", "adaptive" };
+
+/* The OS sleep overshoots by up to a scheduler tick, the last stretch is spent spinning */
+#define FRAME_LIMIT_SPIN_SECONDS 0.002
+
+/* Weight of the newest frame in the smoothed frame time shown on screen */
+#define FRAME_TIME_SMOOTHING 0.05f
+
+/* Frame times kept for the summary; older ones are overwritten */
+#define FRAME_TIME_HISTORY 65536
+
+typedef std::chrono::steady_clock PacingClock;
+
+struct FramePacer {
+    VsyncMode Vsync;
+    double TargetFps;                   // 0 = no limiter
+    PacingClock::time_point Deadline;   // when the next frame may start
+    PacingClock::time_point FrameStart;
+    int Started;
+    float Work;                         // work time of the current frame
+    float SmoothedFrameTime;            // exponential average of all frame times, for display
+    float LastFrameTime;                // of the previous frame, recorded or not
+
+    // Timing of the recorded frames, in seconds
+    std::vector<float> FrameTimes;      // start to start, including vsync and limiter waits
+    std::vector<float> WorkTimes;       // start to just before pacing waits : the headroom
+    long long Frames;
+    double Elapsed;                     // sum of the recorded frame times
+    double LimiterSeconds;              // total time the limiter slept or spun
+} Pacer = { VSYNC_OFF, 0 };  // headless runs never swap, so never wait for vsync
+
+/* Parse "on", "off" or "adaptive" into a VsyncMode, -1 if the name is unknown */
+int parseVsyncMode (const char* name)
+{
+    for (int i=0; i<3; i++)
+        if (!strcmp(name, vsyncModeNames[i]))
+            return i;
+    return -1;
+}
+
+/* Set the swap interval of the current GLFW context.
+   Adaptive vsync needs EXT_swap_control_tear, without it we fall back to plain vsync */
+void applyVsync (VsyncMode mode)
+{
+    if (mode == VSYNC_ADAPTIVE && !glfwExtensionSupported("GLX_EXT_swap_control_tear") &&
+        !glfwExtensionSupported("WGL_EXT_swap_control_tear")) {
+        fprintf(stderr, "Adaptive vsync not supported, using vsync on\n");
+        mode = VSYNC_ON;
+    }
+    Pacer.Vsync = mode;
+    glfwSwapInterval(mode == VSYNC_ADAPTIVE ? -1 : mode == VSYNC_ON ? 1 : 0);
+}
+
+/* history : number of frame times to keep, at least FRAME_TIME_HISTORY */
+void initFramePacer (double target_fps, long history)
+{
+    Pacer.TargetFps = target_fps;
+    Pacer.Started = 0;
+    Pacer.Frames = 0;
+    Pacer.Elapsed = 0;
+    Pacer.LimiterSeconds = 0;
+    Pacer.SmoothedFrameTime = 0;
+    size_t size = std::max(history, (long) FRAME_TIME_HISTORY);
+    Pacer.FrameTimes.assign(size, 0.0f);
+    Pacer.WorkTimes.assign(size, 0.0f);
+}
+
+/* Call at the start of the first frame; later frames start where the previous one finished */
+void beginFrame ()
+{
+    if (!Pacer.Started)
+        Pacer.FrameStart = PacingClock::now();
+    Pacer.Started = 1;
+}
+
+/* Call once the frame's work is done, before it waits for vsync or the limiter */
+void endFrameWork ()
+{
+    Pacer.Work = std::chrono::duration<float>(PacingClock::now() - Pacer.FrameStart).count();
+}
+
+/* Call at the very end of every frame, after all the waiting.
+   record = 0 leaves the frame out of the summary (warmup) */
+void finishFrame (int record)
+{
+    PacingClock::time_point now = PacingClock::now();
+    float frame_time = std::chrono::duration<float>(now - Pacer.FrameStart).count();
+    Pacer.SmoothedFrameTime += (Pacer.SmoothedFrameTime > 0 ? FRAME_TIME_SMOOTHING : 1)*(frame_time - Pacer.SmoothedFrameTime);
+    Pacer.LastFrameTime = frame_time;
+    if (record) {
+        size_t slot = Pacer.Frames % Pacer.FrameTimes.size();
+        Pacer.FrameTimes[slot] = frame_time;
+        Pacer.WorkTimes[slot] = Pacer.Work;
+        Pacer.Elapsed += Pacer.FrameTimes[slot];
+        Pacer.Frames++;
+    }
+    Pacer.FrameStart = now;
+}
+
+/* Wait until the next frame is due when a target frame rate is set */
+void limitFrameRate ()
+{
+    if (Pacer.TargetFps <= 0)
+        return;
+
+    PacingClock::duration period = std::chrono::duration_cast<PacingClock::duration>(std::chrono::duration<double>(1.0/Pacer.TargetFps));
+    PacingClock::time_point now = PacingClock::now();
+    // Deadlines advance by whole periods so the average rate stays exact; after a
+    // long stall (more than a frame late) we restart from now instead of catching up
+    if (Pacer.Deadline.time_since_epoch().count() == 0 || now - Pacer.Deadline > period)
+        Pacer.Deadline = now;
+    Pacer.Deadline += period;
+
+    PacingClock::time_point wake = Pacer.Deadline - std::chrono::duration_cast<PacingClock::duration>(std::chrono::duration<double>(FRAME_LIMIT_SPIN_SECONDS));
+    if (now < wake)
+        std::this_thread::sleep_until(wake);
+    while (PacingClock::now() < Pacer.Deadline)
+        ;
+    Pacer.LimiterSeconds += std::chrono::duration<double>(PacingClock::now() - now).count();
+}
+
+/* Value at percentile p (0-100) of sorted samples */
+static double framePercentile (const std::vector<float>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t) (p/100.0*(sorted.size()-1) + 0.5);
+    return sorted[index];
+}
+
+/* One line of timing statistics, samples in seconds. Shared by every timer report */
+void printTimingLine (const char* name, std::vector<float> samples)
+{
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (size_t i=0; i<samples.size(); i++)
+        total += samples[i];
+    printf("  %-16s ms: avg %7.3lf  min %7.3lf  p50 %7.3lf  p95 %7.3lf  p99 %7.3lf  max %7.3lf\n", name,
+           1000*total/samples.size(), 1000*samples.front(), 1000*framePercentile(samples, 50),
+           1000*framePercentile(samples, 95), 1000*framePercentile(samples, 99), 1000*samples.back());
+}
+
+/* Summary of the recorded frames : rate, frame and work time distributions */
+void printFrameTimeSummary ()
+{
+    if (Pacer.Frames == 0)
+        return;
+
+    size_t count = std::min((size_t) Pacer.Frames, Pacer.FrameTimes.size());
+    std::vector<float> frames (Pacer.FrameTimes.begin(), Pacer.FrameTimes.begin() + count);
+    std::vector<float> work (Pacer.WorkTimes.begin(), Pacer.WorkTimes.begin() + count);
+    double elapsed = Pacer.Elapsed;
+
+    printf("frame timing: %lld frames in %.3lf s, %.1lf fps, vsync %s, limiter ", Pacer.Frames, elapsed,
+           elapsed > 0 ? Pacer.Frames/elapsed : 0.0, vsyncModeNames[Pacer.Vsync]);
+    if (Pacer.TargetFps > 0)
+        printf("%.1lf fps (%.3lf s waiting)\n", Pacer.TargetFps, Pacer.LimiterSeconds);
+    else
+        printf("off\n");
+    if (count < (size_t) Pacer.Frames)
+        printf("  (distributions over the last %ld frames)\n", (long) count);
+    printTimingLine("frame", frames);
+    printTimingLine("work", work);
+}
+
+#endif
@@ -2,7 +2,11 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
+#include <deque>
 #include <string.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <chrono>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,6 +16,23 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "gl_resources.h"
+#include "profiler.h"
+#include "stream_buffer.h"
+#include "headless.h"
+#include "capture.h"
+#include "frame_pacing.h"
+#include "mesh.h"
+#include "gpu_timer.h"
+#include "collision.h"
+#include "text.h"
+#include "render_stats.h"
+#include "perf_overlay.h"
+#include "level_gen.h"
+#include "metrics.h"
+#include "input_replay.h"
+#include "probes.h"
+
 #define GLFW_IBEAM_CURSOR   0x00036002
 #define GLFW_CROSSHAIR_CURSOR   0x00036003
 #define GLFW_HAND_CURSOR   0x00036004
@@ -21,13 +42,10 @@
 using namespace std;
 
 struct VAO {
-    GLuint VertexArrayID;
-    GLuint VertexBuffer;
-    GLuint ColorBuffer;
-
-    GLenum PrimitiveMode;
-    GLenum FillMode;
-    int NumVertices;
+    struct Mesh* mesh;  // geometry, shared with every object of the same shape
+    GLfloat scaleX, scaleY;             // size the unit mesh is drawn at
+    int hasLods;                        // circles : mesh follows the level of detail picked for the size on screen
+    int lod;                            // level mesh is at
     int isCircle;
     int isRectangle;
     double length;
@@ -43,6 +61,11 @@ struct VAO {
     int isTarget;
     int isObstacle;
     int isTranslateable;
+    int isStatic;       // never moves, drawn in the cached static layer
+    // Generated movers : travel along origin[moveAxis] between moveMin and moveMax, carrying rider
+    int moveAxis;
+    double moveMin, moveMax;
+    struct VAO* rider;
 };
 typedef struct VAO VAO;
 
@@ -50,41 +73,184 @@ struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
 	glm::mat4 view;
-	GLuint MatrixID;
+	GLuint MatrixID;        // "VP" uniform
+	GLuint ObjectBaseID;    // "ObjectBase" uniform
+	GLuint TransformsID;    // "ObjectTransforms" sampler
 } Matrices;
 
-GLuint programID;
+GLProgram program;
 GLFWwindow* window;
 int width = 1400;
 int height = 1000;
 
+/* Whether the frame starts from the cached static layer (--static-layer) */
+enum StaticLayerMode { STATIC_LAYER_AUTO, STATIC_LAYER_ON, STATIC_LAYER_OFF };
+static const char* staticLayerModeNames[] = { "auto", "on", "off" };
+
+/* Command line options, also read from game.cfg */
+struct GameOptions {
+    int headless;               // render offscreen through EGL, no window
+    long frames;                // stop after this many frames, 0 = until the window is closed
+    const char* dumpDirectory;  // save frames as PPM files here
+    int dumpInterval;           // save every dumpInterval-th frame
+    const char* capturePath;    // record the session to a .y4m file or a PPM directory
+    int captureFps;             // frame rate written in the .y4m header
+    int captureDelay;           // frames between readback and writing out
+    int vsync;                  // a VsyncMode, -1 = default (on, off when benchmarking)
+    double fpsLimit;            // frame limiter target, 0 = off
+    long benchmarkFrames;       // measure this many frames after a warmup, then quit
+    int debugText;              // show the debug readout under the fps, F3 toggles it
+    const char* tracePath;      // write a profile trace here at exit, and when F2 is pressed
+    double traceSeconds;        // how much of the past a trace covers
+    int bodies;                 // objects in the scene, 0 = the normal level
+    int overlay;                // show the performance overlay, F4 toggles it
+    LevelSpec level;            // generated level, instead of the hand made one
+    const char* metricsEndpoint;    // serve metrics here : unix:PATH or [localhost:]PORT
+    const char* metricsSnapshot;    // append metrics snapshots to this file
+    double metricsInterval;         // seconds between snapshots
+    const char* recordPath;     // record the input to this file
+    const char* replayPath;     // play a recorded input file instead of GLFW's input
+    int staticLayer;            // a StaticLayerMode
+} Options = { 0, 0, NULL, 1, NULL, 60, 3, -1, 0, 0, 0, NULL, PROFILE_DEFAULT_SECONDS, 0, 0, LEVEL_DEFAULT_SPEC,
+              NULL, NULL, METRICS_DEFAULT_INTERVAL, NULL, NULL, STATIC_LAYER_ON };
+
+/* Trace written by F2 when --trace isn't given */
+#define DEFAULT_TRACE_PATH "trace.json"
+
+/* Frames run before a benchmark starts measuring (shader compilation, first uploads) */
+#define BENCHMARK_WARMUP_FRAMES 30
+
+/* Seconds since startup. GLFW's timer needs glfwInit, which fails without a display */
+double gameTime ()
+{
+    if (window)
+        return glfwGetTime();
+    static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Linked programs are cached here with glGetProgramBinary, one file per
+   (shader sources, driver) combination, so later launches skip compilation */
+#define SHADER_CACHE_DIR "shader_cache"
+
+/* Read a whole text file, empty string if it can't be opened */
+std::string readFile(const char * file_path)
+{
+	std::ifstream Stream(file_path, std::ios::in | std::ios::binary);
+	std::stringstream Contents;
+	if(Stream.is_open())
+		Contents << Stream.rdbuf();
+	return Contents.str();
+}
+
+/* 64 bit FNV-1a, chained through hash */
+unsigned long long hashString(const std::string& text, unsigned long long hash = 14695981039346656037ULL)
+{
+	for(size_t i=0; i<text.size(); i++)
+	{
+		hash ^= (unsigned char) text[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* Cache file for a program built from these sources by the current driver */
+std::string programCachePath(const std::string& VertexShaderCode, const std::string& FragmentShaderCode)
+{
+	unsigned long long hash = hashString(VertexShaderCode);
+	hash = hashString(FragmentShaderCode, hash);
+	hash = hashString((const char*) glGetString(GL_VENDOR), hash);
+	hash = hashString((const char*) glGetString(GL_RENDERER), hash);
+	hash = hashString((const char*) glGetString(GL_VERSION), hash);
+
+	char name[64];
+	sprintf(name, "/%016llx.bin", hash);
+	return SHADER_CACHE_DIR + std::string(name);
+}
+
+/* Program binaries need GL 4.1 or GL_ARB_get_program_binary, and a driver exposing at least one format */
+bool programBinarySupported()
+{
+	if(!GLAD_GL_ARB_get_program_binary)
+		return false;
+	GLint Formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &Formats);
+	return Formats > 0;
+}
+
+/* Returns the linked program stored in cache_path, 0 if there is none or the driver rejects it */
+GLuint loadProgramBinary(const std::string& cache_path)
+{
+	std::ifstream CacheStream(cache_path.c_str(), std::ios::in | std::ios::binary);
+	if(!CacheStream.is_open())
+		return 0;
+
+	GLenum Format;
+	if(!CacheStream.read((char*) &Format, sizeof(Format)))
+		return 0;
+	std::stringstream Contents;
+	Contents << CacheStream.rdbuf();
+	std::string Binary = Contents.str();
+	if(Binary.empty())
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, Format, Binary.data(), Binary.size());
+
+	// A driver update or different GPU makes old binaries fail here
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if(Result != GL_TRUE)
+	{
+		printf("Cached program %s rejected, recompiling\n", cache_path.c_str());
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	printf("Loaded cached program : %s\n", cache_path.c_str());
+	return ProgramID;
+}
+
+/* Store a linked program in cache_path */
+void saveProgramBinary(GLuint ProgramID, const std::string& cache_path)
+{
+	GLint Length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &Length);
+	if(Length <= 0)
+		return;
+
+	std::vector<char> Binary(Length);
+	GLenum Format;
+	glGetProgramBinary(ProgramID, Length, NULL, &Format, &Binary[0]);
+
+	mkdir(SHADER_CACHE_DIR, 0755);
+	std::ofstream CacheStream(cache_path.c_str(), std::ios::out | std::ios::binary);
+	if(!CacheStream.is_open())
+		return;
+	CacheStream.write((const char*) &Format, sizeof(Format));
+	CacheStream.write(&Binary[0], Length);
+}
+
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	// Read the Vertex and Fragment Shader code from the files
+	std::string VertexShaderCode = readFile(vertex_file_path);
+	std::string FragmentShaderCode = readFile(fragment_file_path);
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
+	// Use the program linked by an earlier run if the sources and driver haven't changed
+	bool UseCache = programBinarySupported();
+	std::string CachePath;
+	if(UseCache)
 	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+		CachePath = programCachePath(VertexShaderCode, FragmentShaderCode);
+		GLuint CachedProgramID = loadProgramBinary(CachePath);
+		if(CachedProgramID)
+			return CachedProgramID;
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
-	}
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
@@ -120,6 +286,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if(UseCache)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -132,6 +300,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	if(UseCache && Result == GL_TRUE)
+		saveProgramBinary(ProgramID, CachePath);
+
 	return ProgramID;
 }
 
@@ -140,21 +311,41 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
 
+/* Print what the renderer measured during the session */
+void reportStats();
+/* Close the input recording, or check the replay's outcome */
+void finishInputSession();
+
 void quit(GLFWwindow *window)
 {
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    stopCapture();
+    stopMetrics();
+    if (Options.tracePath)
+        writeProfileTrace(Options.tracePath);
+    finishInputSession();
+    reportStats();
+    if (window) {
+        releaseGpuContext();
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    else {
+        // A replayed Esc or q when headless
+        glFinish();
+        releaseGpuContext();
+        destroyHeadless();
+    }
     exit(EXIT_SUCCESS);
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Create a game object drawn with mesh, scaled by (scale_x,scale_y) */
+struct VAO* createObject (struct Mesh* mesh, double scale_x=1, double scale_y=1)
 {
-    struct VAO* vao = new struct VAO;
-    vao->PrimitiveMode = primitive_mode;
-    vao->NumVertices = numVertices;
-    vao->FillMode = fill_mode;
+    struct VAO* vao = new struct VAO();     // zeroed : not every create function sets every field
+    vao->mesh = mesh;
+    vao->scaleX = scale_x;
+    vao->scaleY = scale_y;
     vao->isCircle = 0;
     vao->isRectangle = 0;
     vao->isMoving = 0;
@@ -162,73 +353,270 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     vao->isObstacle = 0;
     vao->isMovable = 0;
     vao->isTranslateable = 0;
+    vao->isStatic = 0;
+    return vao;
+}
 
-    // Create Vertex Array Object
-    // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-                          0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
+/* Create a circle object, drawn with the level of detail that fits its size on screen */
+struct VAO* createCircleObject (double radius)
+{
+    // No mesh until the first queueObject() picks the level, from the finest down
+    struct VAO* vao = createObject(NULL, radius, radius);
+    vao->hasLods = 1;
+    vao->lod = CIRCLE_LODS-1;
     return vao;
 }
 
+/* Generate VAO, VBOs and return VAO handle */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    return createObject(createMesh(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode));
+}
+
+/* Generate VAO, VBOs and an element buffer and return VAO handle - primitives built from numIndices indices */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data,
+                            int numIndices, const GLushort* index_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    return createObject(createMesh(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode, numIndices, index_buffer_data));
+}
+
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+    std::vector<GLfloat> color_buffer_data (3*numVertices);
     for (int i=0; i<numVertices; i++) {
         color_buffer_data [3*i] = red;
         color_buffer_data [3*i + 1] = green;
         color_buffer_data [3*i + 2] = blue;
     }
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
 }
 
-/* Render the VBOs handled by VAO */
-void draw3DObject (struct VAO* vao)
+/* Render the VBOs handled by VAO, instances times : the objects queued in
+   that many consecutive slots from ObjectBase, all drawn with vao's mesh */
+void draw3DObject (struct VAO* vao, int instances=1)
 {
+    struct Mesh* mesh = vao->mesh;
+
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    glPolygonMode (GL_FRONT_AND_BACK, mesh->FillMode);
 
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
+    // Bind the VAO to use, it holds the vertex attribute setup
+    glBindVertexArray (mesh->VertexArray.get());
+    countStateChanges(2);
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    // Draw the geometry !
+    if (mesh->NumIndices)
+        glDrawElementsInstanced(mesh->PrimitiveMode, mesh->NumIndices, GL_UNSIGNED_SHORT, (void*)0, instances);
+    else
+        glDrawArraysInstanced(mesh->PrimitiveMode, 0, mesh->NumVertices, instances); // Starting from vertex 0; 3 vertices total -> 1 triangle
+    countDraw(mesh->NumIndices ? mesh->NumIndices : mesh->NumVertices, instances);
+}
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+/* Compact model transform of one object, stored as two RGBA32F texels */
+struct ObjectTransform {
+    GLfloat x, y;               // translation
+    GLfloat scaleX, scaleY;     // size of the unit mesh
+    GLfloat cosAngle, sinAngle; // rotation about z
+    GLfloat unused[2];
+};
 
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* All the objects queued for this frame and their transforms.
+   The transforms are uploaded in one go and looked up by slot in the vertex shader */
+struct TransformBuffer {
+    struct StreamBuffer Stream;
+    GLTexture Texture;
+    std::vector<ObjectTransform> transforms;  // slot -> transform
+    std::vector<struct VAO*> objects;         // slot -> object, in draw order
+    std::vector<int> passStart;               // first slot of each timed pass
+    std::vector<int> passTimer;               // GPU timer of each pass, -1 = untimed
+} Transforms;
+
+/* GPU timer scopes of the frame's render passes */
+struct RenderPassTimers {
+    int StaticLayer;    // static layer redraw and copy
+    int Scene;          // level objects and ball
+    int Rotator;        // aiming rotator
+    int Text;           // score, chances, fps and debug text
+} PassTimers;
+
+/* Objects queued from now on are drawn inside GPU timer scope timer, -1 for none */
+void beginQueuedPass (int timer)
+{
+    Transforms.passStart.push_back(Transforms.objects.size());
+    Transforms.passTimer.push_back(timer);
+}
+
+/* Create the texture buffer holding the per-frame object transforms */
+void initTransformBuffer ()
+{
+    initStreamBuffer(&Transforms.Stream, GL_TEXTURE_BUFFER, 256*sizeof(ObjectTransform));
+    // Every pass of a frame, so switching the static layer off doesn't allocate
+    Transforms.passStart.reserve(8);
+    Transforms.passTimer.reserve(8);
+
+    Transforms.Texture = GLTexture::generate();
+    glBindTexture (GL_TEXTURE_BUFFER, Transforms.Texture.get());
+    glTexBuffer (GL_TEXTURE_BUFFER, GL_RGBA32F, Transforms.Stream.Buffer);
+}
+
+/* Objects entirely outside the view rectangle are not queued. The rectangle
+   follows the glm::ortho bounds, which the zoom keys shrink through display_x/y */
+struct ViewCulling {
+    float minX, minY, maxX, maxY;
+    long long Queued, Culled;       // over the whole session
+    int FrameCulled;                // since the last setViewRectangle
+} Culling = { -4, -4, 4, 4, 0, 0, 0 };
+
+/* Screen pixels per world unit, for picking levels of detail */
+double view_pixels_per_unit = 1;
+
+/* Call once per frame with the projection's bounds */
+void setViewRectangle (float minX, float minY, float maxX, float maxY)
+{
+    Culling.minX = minX;
+    Culling.minY = minY;
+    Culling.maxX = maxX;
+    Culling.maxY = maxY;
+    Culling.FrameCulled = 0;
+    resetCircleLodStats();
+}
+
+/* Queue an object to be drawn this frame, translated to (x,y) and rotated by angle degrees.
+   Returns its slot, or -1 if it is out of view and was culled */
+int queueObject (struct VAO* vao, double x, double y, double angle=0, double scale=1)
+{
+    // Rotation doesn't matter : test the circle around the mesh against the view.
+    // Every level of detail of a circle is a unit circle
+    double r = (vao->hasLods ? 1 : vao->mesh->Radius)*scale*max(fabs(vao->scaleX), fabs(vao->scaleY));
+    if (x + r < Culling.minX || x - r > Culling.maxX || y + r < Culling.minY || y - r > Culling.maxY) {
+        Culling.Culled++;
+        Culling.FrameCulled++;
+        return -1;
+    }
+    Culling.Queued++;
+
+    if (vao->hasLods) {
+        vao->lod = selectCircleLod(vao->lod, r*view_pixels_per_unit);
+        vao->mesh = getCircleLod(vao->lod);
+    }
+
+    ObjectTransform t;
+    t.x = x;
+    t.y = y;
+    t.scaleX = vao->scaleX*scale;
+    t.scaleY = vao->scaleY*scale;
+    t.cosAngle = cos(angle*M_PI/180.0f);
+    t.sinAngle = sin(angle*M_PI/180.0f);
+    t.unused[0] = t.unused[1] = 0;
+    Transforms.transforms.push_back(t);
+    Transforms.objects.push_back(vao);
+    return Transforms.objects.size() - 1;
+}
+
+/* Everything that never moves (background, platform, base, fixed rectangles)
+   is rendered once into this framebuffer and copied into every frame.
+   It is only redrawn after a zoom change, a window resize or a level edit.
+   The copy is a full screen of pixels every frame : with few static objects
+   drawing them is cheaper, so --static-layer auto times both and keeps the faster */
+struct StaticLayer {
+    GLFramebuffer Framebuffer;
+    GLTexture Color;
+    int Width, Height;
+    int Valid;
+    int Enabled;        // the frame starts from the layer, else the static objects are drawn in it
+    int Probe;          // auto : frames timed so far, -1 once decided
+    double Cost[2];     // auto : seconds of the frames timed with the layer off, on
+} StaticCache;
+
+/* --static-layer auto : frames before timing, then frames timed with the layer on
+   and as many with it off. The first frame after each switch is left out.
+   GPU timers can't be used : llvmpipe only renders when something waits for it */
+#define STATIC_LAYER_PROBE_WARMUP 30
+#define STATIC_LAYER_PROBE_FRAMES 30
+
+GLuint frame_framebuffer = 0;               // framebuffer frames are rendered into, 0 = the window
+int frame_width = 1400, frame_height = 1000;
+
+void invalidateStaticLayer ()
+{
+    StaticCache.Valid = 0;
+}
+
+/* (Re)create the static layer's colour texture and framebuffer at the frame size */
+void allocateStaticLayer ()
+{
+    StaticCache.Width = frame_width;
+    StaticCache.Height = frame_height;
+
+    StaticCache.Color = GLTexture::generate();
+    glBindTexture (GL_TEXTURE_2D, StaticCache.Color.get());
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, frame_width, frame_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    StaticCache.Color.setSize(4LL*frame_width*frame_height);
+
+    StaticCache.Framebuffer = GLFramebuffer::generate();
+    glBindFramebuffer (GL_FRAMEBUFFER, StaticCache.Framebuffer.get());
+    glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, StaticCache.Color.get(), 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "Error: static layer framebuffer incomplete\n");
+    glBindFramebuffer (GL_FRAMEBUFFER, frame_framebuffer);
+}
+
+/* Upload the transforms of all queued objects and draw them in the order they were queued */
+void drawQueuedObjects ()
+{
+    int count = Transforms.objects.size();
+    if (count == 0) {
+        // Passes opened with nothing queued in them must not leak into the next call
+        Transforms.passStart.clear();
+        Transforms.passTimer.clear();
+        return;
+    }
+
+    GLsizeiptr size = count*sizeof(ObjectTransform);
+    glActiveTexture (GL_TEXTURE0);
+    glBindTexture (GL_TEXTURE_BUFFER, Transforms.Texture.get());
+    if (reserveStreamBuffer(&Transforms.Stream, size))
+        glTexBuffer (GL_TEXTURE_BUFFER, GL_RGBA32F, Transforms.Stream.Buffer);
+
+    GLintptr offset;
+    void* data = mapStreamBuffer(&Transforms.Stream, size, &offset);
+    memcpy(data, &Transforms.transforms[0], size);
+    unmapStreamBuffer(&Transforms.Stream);
+    glUniform1i (Matrices.TransformsID, 0);
+    countStateChanges(3);
+
+    // This frame's transforms start at slot 'first' of the buffer texture.
+    // Each run of consecutive objects sharing a mesh is one instanced draw
+    int first = offset / sizeof(ObjectTransform);
+    size_t pass = 0;
+    int timer = -1;
+    for (int i=0; i<count; ) {
+        while (pass < Transforms.passStart.size() && Transforms.passStart[pass] == i) {
+            endGpuTimer(timer);
+            timer = Transforms.passTimer[pass++];
+            beginGpuTimer(timer);
+        }
+        // A run ends at the next mesh change or timed pass
+        int end = pass < Transforms.passStart.size() ? Transforms.passStart[pass] : count;
+        int run = 1;
+        while (i + run < end && Transforms.objects[i + run]->mesh == Transforms.objects[i]->mesh)
+            run++;
+        glUniform1i (Matrices.ObjectBaseID, first + i);
+        countStateChanges();
+        draw3DObject (Transforms.objects[i], run);
+        i += run;
+    }
+    endGpuTimer(timer);
+    fenceStreamBuffer(&Transforms.Stream);
+
+    Transforms.transforms.clear();
+    Transforms.objects.clear();
+    Transforms.passStart.clear();
+    Transforms.passTimer.clear();
 }
 
 /**************************
@@ -254,6 +642,10 @@ float zoom=0;
 float display_x,display_y;
 int chances = 7;
 int no_objects=0;
+int generated_level=0;      // the level came from generateLevel
+int hand_made_level=0;      // the objects sit at levelLayout's indices, which collision() and updateObjects() rely on
+uint32_t level_checksum=0;  // of the generated level
+long simulation_tick=0;     // ticks simulated so far, what recorded input is timed by
 
 
 /* Executed when a regular key is pressed/released/held-down */
@@ -261,6 +653,8 @@ int no_objects=0;
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 {
      // Function is called first on GLFW_PRESS.
+    if (!acceptInput(simulation_tick, gameTime(), INPUT_KEY, key, action, mods))
+        return;
 
     if (action == GLFW_RELEASE) {
         switch (key) {
@@ -278,11 +672,13 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                   no_objects--;
 
 
-                  key_release_time = glfwGetTime();
+                  key_release_time = Input.EventTime;
               //    printf("%lf\n", ball_angle);
                   ball_velocity_y = (key_release_time-key_press_time)*15*sin(ball_angle*M_PI/180.0f);
                   ball_velocity_x = (key_release_time - key_press_time)*15*cos(ball_angle*M_PI/180.0f);
                   flag=1;
+                  GAME_PROBE4(shot_fired, simulation_tick, (long) (1e6*(key_release_time - key_press_time)),
+                              (long) (1000*ball_angle), chances);
                   break;
 
             default:
@@ -294,8 +690,20 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
             case GLFW_KEY_ESCAPE:
                 quit(window);
                 break;
+            case GLFW_KEY_F2:
+                {
+                    AllocationExemption exempt;
+                    writeProfileTrace(Options.tracePath ? Options.tracePath : DEFAULT_TRACE_PATH);
+                }
+                break;
+            case GLFW_KEY_F3:
+                Options.debugText = !Options.debugText;
+                break;
+            case GLFW_KEY_F4:
+                Options.overlay = !Options.overlay;
+                break;
             case GLFW_KEY_SPACE:
-                key_press_time = glfwGetTime();
+                key_press_time = Input.EventTime;
                 flag=0;
                 ball_x = -3.75;
                 ball_y = -2.8;
@@ -315,6 +723,7 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                   zoom=10;
                 display_x=zoom*0.1;
                 display_y=zoom*0.1;
+                invalidateStaticLayer();
                 break;
             default:
                 break;
@@ -324,6 +733,7 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                   zoom=-4;
                 display_x=zoom*0.1;
                 display_y=zoom*0.1;
+                invalidateStaticLayer();
 
         }
     }
@@ -332,6 +742,8 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 /* Executed for character input (like in text boxes) */
 void keyboardChar (GLFWwindow* window, unsigned int key)
 {
+	if (!acceptInput(simulation_tick, gameTime(), INPUT_CHAR, key))
+		return;
 	switch (key) {
 		case 'Q':
 		case 'q':
@@ -346,6 +758,8 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 /* Executed when a mouse button is pressed/released */
 void mouseButton (GLFWwindow* window, int button, int action, int mods)
 {
+    if (!acceptInput(simulation_tick, gameTime(), INPUT_MOUSE, button, action, mods))
+        return;
     switch (button) {
         case GLFW_MOUSE_BUTTON_LEFT:
             if (action == GLFW_RELEASE)
@@ -369,12 +783,17 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     int fbwidth=width, fbheight=height;
     /* With Retina display on Mac OS X, GLFW's FramebufferSize
      is different from WindowSize */
-    glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    if (window) {
+        glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    }
 
 	GLfloat fov = 90.0f;
 
 	// sets the viewport of openGL renderer
 	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+	frame_width = fbwidth;
+	frame_height = fbheight;
+	invalidateStaticLayer();
 
 	// set the projection matrix as perspective
 	/* glMatrixMode (GL_PROJECTION);
@@ -388,42 +807,24 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     Matrices.projection = glm::ortho(-4.0f, float(4.0), -4.0f, float(4.0), 0.1f, 500.0f);
 }
 
-VAO *triangle, *ball, *base, *Rotator, *platform,*Rectangle,*Target,*Obstacle , *score;
-VAO* Objects[100];
-VAO* scoElements[100];
+VAO *triangle, *ball, *base, *Rotator, *platform,*Rectangle,*Target,*Obstacle;
+std::vector<VAO*> Objects;   // the first no_objects are in play
+
+/* Put obj in play after the objects already there */
+void addObject(VAO* obj)
+{
+  if(no_objects < (int) Objects.size())
+    Objects[no_objects] = obj;
+  else
+    Objects.push_back(obj);
+  no_objects++;
+}
 //int no_objects=0;
-int no_scoelements = 0;
 
 // Creates the triangle object used in this sample code
 void createRectangle(double length,double width,double x,double y,double velocity,int translate)
 {
-  GLfloat vertex_buffer_data [] = {
-    0,0,0,
-    length,0,0,
-    length,width,0,
-
-
-    0,0,0,
-    length,width,0,
-    0,width,0
-  };
-
-   GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-
-  //  1,0,0,
-//    0,0,1,
-//    0,1,0
-
-  };
-
-  Rectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  Rectangle = createObject(getMesh(MESH_QUAD), length, width);
   
   Rectangle->isRectangle = 1;
   Rectangle->length = length;
@@ -434,47 +835,20 @@ void createRectangle(double length,double width,double x,double y,double velocit
   Rectangle->origin[1]=y;
   Rectangle->origin[2]=0;
   Rectangle ->isTranslateable = translate;
+  Rectangle->isStatic = !translate;
   Rectangle->velocity_x = velocity;
   Rectangle->velocity_angular = 0;
   Rectangle->rotation_angle = 0;
 
 // cout << platform->length << "  " << platform->width << endl;
-  Objects[no_objects]=Rectangle;
-  no_objects++;
+  addObject(Rectangle);
+  invalidateStaticLayer();
 
 
 }
 void createPlateform()
 {
-  static const GLfloat vertex_buffer_data [] = {
-    0,0,0,
-    7.5,0,0,
-    7.5,0.1,0,
-
-
-    0,0,0,
-    7.5,0.1,0,
-    0,0.1,0
-  };
-
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-
-  //  1,0,0,
-//    0,0,1,
-//    0,1,0
-
-  };
-
-  platform = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-  //cout << "hi " << endl;
-//  cout << platform->NumVertices << endl;
+  platform = createObject(getMesh(MESH_QUAD), 7.5, 0.1);
   platform->isRectangle = 1;
   platform->length = 7.5;
   platform->width = 0.1;
@@ -482,10 +856,11 @@ void createPlateform()
   platform->origin[1]=-4;
   platform->origin[2]=0;
   platform->isMovable = 0;
+  platform->isStatic = 1;
 
 // cout << platform->length << "  " << platform->width << endl;
-  Objects[no_objects]=platform;
-  no_objects++;
+  addObject(platform);
+  invalidateStaticLayer();
 
 }
 void createTriangle ()
@@ -515,101 +890,25 @@ void createTriangle ()
 // Creates the rectangle object used in this sample code
 void createBase()
 {
-  static const GLfloat vertex_buffer_data[] = {
-    0,0,0,
-    0.5,0,0,
-    0.5,1,0,
-
-
-    0,0,0,
-    0,1,0,
-    0.5,1,0
-
-  };
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-  };
-
-  base = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  base = createObject(getMesh(MESH_QUAD), 0.5, 1);
+  base->isStatic = 1;
+  invalidateStaticLayer();
 
 }
 void createBall ()
 {
-  GLfloat vertex_buffer_data [1000];
-int i=0,j=0;
-for(i=0;i<72;i++){
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=(0.15f)*cos((i*5)*3.14/180);
-  vertex_buffer_data[j++]=(0.15f)*sin((i*5)*3.14/180);
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=(0.15f)*cos(((i*5)+5)*3.14/180);
-  vertex_buffer_data[j++]=(0.15f)*sin(((i*5)+5)*3.14/180);
-  vertex_buffer_data[j++]=0;
-
-
-
-}
-
-j=0;
- GLfloat color_buffer_data [1000];
-    for(i=0;i<72;i++)
-    {
-      color_buffer_data[j++]=1;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=1;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=1;
-
-
-    }
-
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  ball = create3DObject(GL_TRIANGLES, 216, vertex_buffer_data, color_buffer_data, GL_FILL);
+  ball = createCircleObject(0.15);
   ball->isCircle = 1;
   ball->radius = 0.2;
   ball->origin[0] = ball_x;
   ball->origin[1] = ball_y;
   ball->origin[2] = 0;
   ball->isMovable = 1;
-  Objects[no_objects]=ball;
-  no_objects++;
+  addObject(ball);
 }
 void createRotator()
 {
-  static const GLfloat vertex_buffer_data[] = {
-    0,0,0,
-    1,0,0,
-    1,0.1,0,
-
-
-    0,0,0,
-    0,0.1,0,
-    1,0.1,0
-
-  };
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-  };
-
-  Rotator = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  Rotator = createObject(getMesh(MESH_QUAD), 1, 0.1);
 
 }
 
@@ -618,43 +917,7 @@ float rectangle_rotation = 0;
 float triangle_rotation = 0;
 void createTarget(double x,double y,double radius,double velocity,int translate)
 {
-
-  GLfloat vertex_buffer_data [1000];
-  int i=0,j=0;
-  for(i=0;i<72;i++){
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=(radius)*cos((i*5)*3.14/180);
-  vertex_buffer_data[j++]=(radius)*sin((i*5)*3.14/180);
-  vertex_buffer_data[j++]=0;
-  vertex_buffer_data[j++]=(radius)*cos(((i*5)+5)*3.14/180);
-  vertex_buffer_data[j++]=(radius)*sin(((i*5)+5)*3.14/180);
-  vertex_buffer_data[j++]=0;
-
-
-
-  }
-
-  j=0;
-  GLfloat color_buffer_data [1000];
-    for(i=0;i<72;i++)
-    {
-      color_buffer_data[j++]=1;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=1;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=0;
-      color_buffer_data[j++]=1;
-
-
-    }
-
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  Target = create3DObject(GL_TRIANGLES, 216, vertex_buffer_data, color_buffer_data, GL_FILL);
+  Target = createCircleObject(radius);
   Target->isTarget = 1;
   Target->radius = radius;
   Target->origin[0] = x;
@@ -664,447 +927,281 @@ void createTarget(double x,double y,double radius,double velocity,int translate)
   Target->isMovable = 1;
   Target->isTranslateable = translate;
   Target->velocity_x = velocity;
-  Objects[no_objects]=Target;
-  no_objects++;
+  addObject(Target);
 
 
 }
-void createObstacles(double x,double y)
+void createObstacles(double x,double y,double size=1)
 {
-
-  static const GLfloat vertex_buffer_data[] = {
-    -0.5,-0.05,0,
-    0.5,-0.05,0,
-    0.5,0.05,0,
-
-
-    -0.5,-0.05,0,
-    -0.5,0.05,0,
-    0.5,0.05,0
-
-  };
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-  };
-
-  Obstacle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  Obstacle = createObject(getMesh(MESH_CENTRED_QUAD), size, 0.1*size);
   Obstacle->isObstacle = 1;
   //Target->radius = radius;
-  Obstacle->length = 1;
-  Obstacle->radius = 0.2;
-  Obstacle->width = 0.1;
+  Obstacle->length = size;
+  Obstacle->radius = 0.2*size;
+  Obstacle->width = 0.1*size;
   Obstacle->origin[0] = x;
   Obstacle->origin[1] = y;
   Obstacle->origin[2] = 0;
   Obstacle->isMovable = 1;
   Obstacle->rotation_angle = 90;
-  Objects[no_objects]=Obstacle;
-  no_objects++;
+  addObject(Obstacle);
 }
-void createScore(double x , double y,int digit ){
-
-
-  if(digit==1)
-  {
-     GLfloat vertex_buffer_data [] = {
-      x,y,0,
-      x+0.5,y,0,
-      x,y+0.1,0,
-
-
-      x,y+0.1,0,
-      x+0.5,y,0,
-      x+0.5,y+0.1,0
 
+/* The level's bodies, in the order initGL creates them : collision() and the
+   object loop in draw() rely on the indices this gives (ball 0, platform 1) */
+static const LevelBody levelLayout[] = {
+  { BODY_RECTANGLE,    -2,    -2,   1, 0.5,   0, 0 },
+  { BODY_RECTANGLE,     0,    -3,   1, 0.5,   0, 0 },
+  { BODY_TARGET,        3,    -2, 0.2,   0,   0, 0 },
+  { BODY_TARGET,        3,   1.5, 0.2,   0,   0, 0 },
+  { BODY_OBSTACLE,   -1.5,     0,   1,   0,   0, 0 },
+  { BODY_OBSTACLE,   -1.5,   2.5,   1,   0,   0, 0 },
+  { BODY_TARGET,      0.9,   1.5, 0.2,   0,   0, 0 },
+  { BODY_RECTANGLE,     2,    -1,   1, 0.5,   0, 0 },
+  { BODY_TARGET,      3.8, -0.25, 0.2,   0,   0, 0 },
+  { BODY_TARGET,     -1.5,  1.25, 0.2,   0,   0, 0 },
+  { BODY_RECTANGLE,    -1,   0.6,   1, 0.4, 0.5, 1 },
+  { BODY_TARGET,     -0.5,   1.2, 0.2,   0, 0.5, 1 },
+  { BODY_RECTANGLE,     1,   0.6,   1, 0.4, 0.5, 1 },
+  { BODY_TARGET,      1.5,   1.2, 0.2,   0, 0.5, 1 },
+  { BODY_RECTANGLE,  -3.1,     0,   1, 0.4, 0.5, 1 },
+  { BODY_TARGET,     -2.5,   0.6, 0.2,   0, 0.5, 1 },
+  // Chance markers, one is taken away per shot
+  { BODY_TARGET,     -3.9,   3.8, 0.1,   0,   0, 0 },
+  { BODY_TARGET,     -3.9,   3.6, 0.1,   0,   0, 0 },
+  { BODY_TARGET,     -3.9,   3.4, 0.1,   0,   0, 0 },
+  { BODY_TARGET,     -3.9,   3.2, 0.1,   0,   0, 0 },
+  { BODY_TARGET,     -3.9,     3, 0.1,   0,   0, 0 },
+  { BODY_TARGET,     -3.9,   2.8, 0.1,   0,   0, 0 },
+  { BODY_TARGET,     -3.9,   2.6, 0.1,   0,   0, 0 }
+};
 
-    };
-   GLfloat color_buffer_data [] = {
-      1,0,0, // color 1
-      0,0,1, // color 2
-      0,1,0, // color 3
-
-
-
-      0,1,0, // color 3
-      0.3,0.3,0.3, // color 4
-      1,0,0  // colo
-    };
-    scoElements[no_scoelements] =  create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-
-  }
+/* The chance markers end levelLayout : generated levels end with them too */
+#define CHANCE_MARKERS 7
+
+/* The tracks updateObjects() keeps the hand made level's sliders on (objects
+   12, 14 and 16), given to the copies of the level in tiled scenes instead */
+static const struct {
+  int body;
+  int axis;
+  double min, max;
+} levelLayoutTracks[] = {
+  { 10, 0, -1.55, -0.1 },
+  { 12, 0,     1,  2.2 },
+  { 14, 1,     0,    3 }
+};
 
-else   if(digit==2)
+/* Create count bodies scaled by scale about the bottom left corner of the
+   view, then moved by (dx,dy) */
+void createLevelBodies(const LevelBody* bodies, size_t count, double scale=1, double dx=0, double dy=0)
+{
+  VAO* mover = NULL;
+  for(size_t i=0;i<count;i++)
   {
-//    cout<<"QWERT "<<x<<' '<<y<<endl;
-
-     GLfloat vertex_buffer_data[] = {
-      x+0.5,y,0,
-      x+0.5+0.05,y,0,
-      x+0.5,y-0.5,0,
-
-      x+0.5,y-0.5,0,
-      x+0.5+0.05,y,0,
-      x+0.5+0.05,y-0.5,0
-
-    };
-     GLfloat color_buffer_data [] = {
-      1,0,0, // color 1
-      0,0,1, // color 2
-      0,1,0, // color 3
-
-
-      0,1,0, // color 3
-      0.3,0.3,0.3, // color 4
-      1,0,0  // colo
-    };
-    scoElements[no_scoelements] =  create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-
+    const LevelBody& b = bodies[i];
+    double x = -4 + (b.x+4)*scale + dx;
+    double y = -4 + (b.y+4)*scale + dy;
+    if(b.kind == BODY_RECTANGLE)
+      createRectangle(b.length*scale, b.width*scale, x, y, b.velocity*scale, b.translate);
+    else if(b.kind == BODY_TARGET)
+      createTarget(x, y, b.length*scale, b.velocity*scale, b.translate);
+    else
+      createObstacles(x, y, b.length*scale);
+
+    // A target right after a mover rides on it
+    if(mover && b.kind == BODY_TARGET)
+      mover->rider = Target;
+    mover = NULL;
+    if(b.kind == BODY_RECTANGLE && b.moveMax > b.moveMin)
+    {
+      mover = Rectangle;
+      mover->moveAxis = b.moveAxis;
+      mover->moveMin = -4 + (b.moveMin+4)*scale + (b.moveAxis ? dy : dx);
+      mover->moveMax = -4 + (b.moveMax+4)*scale + (b.moveAxis ? dy : dx);
+    }
   }
-else   if(digit==3)
-  {
-     GLfloat vertex_buffer_data[] = {
-      x,y,0,
-      x,y-0.5,0,
-      x-0.05,y,0,
-
-      x,y-0.5,0,
-      x-0.05,y,0,
-      x-0.05,y-0.5,0
-
-  };
- GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
-
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // colo
-  };
-  scoElements[no_scoelements] =  create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-
-
 }
-else   if(digit==4)
-  {
-   GLfloat vertex_buffer_data[] = {
-      x,y-0.5+0.05,0,
-      x+0.5,y-0.5+0.05,0,
-      x+0.5,y-0.5-0.1+0.05,0,
-
-        x,y-0.5+0.05,0,
-        x+0.5,y-0.5-0.1+0.05,0,
-        x,y-0.5-0.1+0.05,0
-
-  };
- GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
 
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // colo
-  };
-  scoElements[no_scoelements] =  create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-
-
-}
-else  if(digit==5)
+void createLevel(double scale=1, double dx=0, double dy=0)
 {
-   GLfloat vertex_buffer_data[] = {
-    x,y-0.5,0,
-    x-0.05,y-0.5,0,
-    x,y-1,0,
-
-    x-0.05,y-0.5,0,
-    x,y-1,0,
-    x-0.05,y-1,0,
-
-
-};
-GLfloat color_buffer_data [] = {
-  1,0,0, // color 1
-  0,0,1, // color 2
-  0,1,0, // color 3
-
-  0,1,0, // color 3
-  0.3,0.3,0.3, // color 4
-  1,0,0  // colo
-};
-scoElements[no_scoelements] =  create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-
-
+  createLevelBodies(levelLayout, sizeof(levelLayout)/sizeof(levelLayout[0]), scale, dx, dy);
 }
-else if(digit==6)
-{
-   GLfloat vertex_buffer_data[] = {
-    x+0.5,y-0.5,0,
-    x+0.5,y-1,0,
-    x+0.5+0.05,y-0.5,0,
-
-    x+0.5+0.05,y-0.5,0,
-    x+0.5,y-1,0,
-    x+0.5+0.05,y-1,0
 
-
-};
- GLfloat color_buffer_data [] = {
-  1,0,0, // color 1
-  0,0,1, // color 2
-  0,1,0, // color 3
-
-
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // colo
-};
-scoElements[no_scoelements] =  create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-
-
-}
-else if(digit==7)
+/* Append a copy of the level without its chance markers, scaled and moved like
+   createLevelBodies does, its sliders turned into movers on their tracks */
+void appendLevelCopy(std::vector<LevelBody>& bodies, double scale, double dx, double dy)
 {
-    GLfloat vertex_buffer_data[] = {
-    x,y-1,0,
-    x+0.5,y-1,0,
-    x,y-1-0.1,0,
-
-    x+0.5,y-1,0,
-    x,y-1-0.1,0,
-    x+0.5,y-1-0.1,0
-
-
-};
- GLfloat color_buffer_data [] = {
-  1,0,0, // color 1
-  0,0,1, // color 2
-  0,1,0, // color 3
-
-
-  0,1,0, // color 3
-  0.3,0.3,0.3, // color 4
-  1,0,0  // colo
-};
-scoElements[no_scoelements] =  create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
-
+  int layout = sizeof(levelLayout)/sizeof(levelLayout[0]) - CHANCE_MARKERS;
+  int first = bodies.size();
+  for(int i=0;i<layout;i++)
+  {
+    LevelBody b = levelLayout[i];
+    b.x = -4 + (b.x+4)*scale + dx;
+    b.y = -4 + (b.y+4)*scale + dy;
+    b.length *= scale;
+    b.width *= scale;
+    b.velocity *= scale;
+    bodies.push_back(b);
+  }
+  for(size_t i=0;i<sizeof(levelLayoutTracks)/sizeof(levelLayoutTracks[0]);i++)
+  {
+    LevelBody& b = bodies[first + levelLayoutTracks[i].body];
+    double offset = levelLayoutTracks[i].axis ? dy : dx;
+    b.moveAxis = levelLayoutTracks[i].axis;
+    b.moveMin = -4 + (levelLayoutTracks[i].min+4)*scale + offset;
+    b.moveMax = -4 + (levelLayoutTracks[i].max+4)*scale + offset;
+  }
 }
 
+/* A level from generateLevel, then the chance markers */
+void createGeneratedLevel(const LevelSpec& spec)
+{
+  std::vector<LevelBody> bodies;
+  generateLevel(spec, bodies);
+  printLevelSpec(spec, bodies);
+  generated_level = 1;
+  level_checksum = levelChecksum(bodies);
+  createLevelBodies(&bodies[0], bodies.size());
+  int layout = sizeof(levelLayout)/sizeof(levelLayout[0]);
+  createLevelBodies(levelLayout + layout - CHANCE_MARKERS, CHANCE_MARKERS);
+}
 
+/* The objects in play : the level, or with bodies > 0 a scene of exactly that many
+   objects. Bigger scenes add copies of the level shrunk into a grid of tiles over
+   the view, smaller ones cut the level short. A generated level replaces all of it.
+   Tiled scenes are built like generated levels, without the hand made index tricks */
+void createScene(int bodies, const LevelSpec& level)
+{
+  createBall();
+  createBase();
+  createRotator();
+  createPlateform();
+  if(level.Generate)
+  {
+    createGeneratedLevel(level);
+    return;
+  }
+  int layout = sizeof(levelLayout)/sizeof(levelLayout[0]);
+  if(bodies <= no_objects + layout)
+  {
+    hand_made_level = 1;
+    createLevel();
+    if(bodies > 0)
+      no_objects = min(no_objects, bodies);
+    return;
+  }
 
-
+  // The level at full size, then the tiles, then the chance markers
+  std::vector<LevelBody> scene;
+  int room = bodies - no_objects - CHANCE_MARKERS;
+  int per_tile = layout - CHANCE_MARKERS;
+  int tiles = (room - per_tile + per_tile - 1) / per_tile;
+  // Like generated levels, nothing in the launcher's corner : tile 0 stays empty
+  int grid = (int) ceil(sqrt((double) (tiles + 1)));
+  appendLevelCopy(scene, 1, 0, 0);
+  for(int t=1;t<=tiles;t++)
+    appendLevelCopy(scene, 1.0/grid, (t%grid)*8.0/grid, (t/grid)*8.0/grid);
+  scene.resize(room);
+  scene.insert(scene.end(), levelLayout + layout - CHANCE_MARKERS, levelLayout + layout);
+  createLevelBodies(&scene[0], scene.size());
 }
 
 /* Render the scene with openGL */
 /* Edit this function according to your assignment */
 void drawscore()
 {
+  PROFILE_ZONE("drawscore");
+  // Text cells scale with the framebuffer : 16 pixels at the default height
+  float size = 8*max(1, frame_height/500);
+  char text[32];
+  snprintf(text, sizeof(text), "%d", sco);
+  queueText(frame_width - textWidth(text, 2*size) - size, frame_height - 3*size, 2*size, 1, 1, 1, text);
+  // Next to the column of chance markers
+  queueTextf(3*size, frame_height - 2*size, size, 1, 1, 0.4, "Chances %d", max(chances, 0));
+}
 
-      int number = sco;
-    //  number = 55;
-      int dig,iteration=0;
-      double xcor;
-      no_scoelements = 0;
-      do
-      {
-        dig=number%10;
-        number=number/10;
-        xcor=(double)3.3-iteration*0.8;
-        if(dig==0)
-        {
-          createScore(xcor,3.8,1);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,2);
-        //  scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,3);
-        //  scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,5);
-        //  scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,7);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
+/* Frame rate under the score, and the debug readout when it is switched on */
+void drawStatsText()
+{
+  float size = 8*max(1, frame_height/500);
+  float right = frame_width - size;
+  char text[512];
+  snprintf(text, sizeof(text), "%.0f fps", Pacer.SmoothedFrameTime > 0 ? 1/Pacer.SmoothedFrameTime : 0.0f);
+  queueText(right - textWidth(text, size), frame_height - 5*size, size, 0.8, 0.8, 0.8, text);
+  if (!Options.debugText)
+    return;
+
+  snprintf(text, sizeof(text),
+           "frame %6.2f ms\n"
+           "work  %6.2f ms\n"
+           "culled %d\n"
+           "circle lods %d %d %d %d\n"
+           "gpu static %5.2f ms\n"
+           "gpu scene  %5.2f ms\n"
+           "gpu text   %5.2f ms",
+           1000*Pacer.SmoothedFrameTime, 1000*Pacer.Work, Culling.FrameCulled,
+           CircleLods.FrameObjects[0], CircleLods.FrameObjects[1], CircleLods.FrameObjects[2], CircleLods.FrameObjects[3],
+           1000*lastGpuTime(PassTimers.StaticLayer), 1000*lastGpuTime(PassTimers.Scene), 1000*lastGpuTime(PassTimers.Text));
+  queueText(right - textWidth(text, size), frame_height - 7*size, size, 0.6, 1, 0.6, text);
+}
 
-        }
-        if(dig==1)
-        {
-          createScore(xcor,3.8,2);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==2)
-        {
-          createScore(xcor,3.8,1);
-        //  scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,4);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,2);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,5);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,7);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==3)
-        {
-          createScore(xcor,3.8,1);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,2);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,4);
-      ///    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,7);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==4)
-        {
-          createScore(xcor,3.8,3);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,4);
-        //  scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,2);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==5)
-        {
-          createScore(xcor,3.8,1);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,3);
-        //  scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,4);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,7);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==6)
-        {
-          createScore(xcor,3.8,1);
-      //    scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,3);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,5);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,7);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,4);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==7)
-        {
-          createScore(xcor,3.8,1);
-//          scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,2);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==8)
-        {
-          createScore(xcor,3.8,1);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,2);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,3);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,4);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,5);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,7);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
-        if(dig==9)
-        {
-          createScore(xcor,3.8,3);
-//          scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,1);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,2);
-    //      scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,6);
-  //        scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,4);
-//          scoElements[no_scoelements]=score;
-          no_scoelements++;
-          createScore(xcor,3.8,7);
-//          scoElements[no_scoelements]=score;
-          no_scoelements++;
-        }
 
-        iteration++;
-      }
-      while(number!=0);
+/* What --metrics publishes about the game. The metrics stay NULL when it isn't
+   given, and updating a NULL metric does nothing */
+struct GameMetricSet {
+    Metric* Frames;
+    Metric* FrameSeconds;       // whole frame, pacing included
+    Metric* WorkSeconds;        // the frame's own work
+    Metric* TickSeconds;        // simulate()
+    Metric* CollisionPairs;     // ball / body pairs tested, last frame
+    Metric* CollisionPairsTotal;
+    Metric* DrawCalls;
+    Metric* GLObjects[GPU_RESOURCE_KINDS];
+    long FramePairs;            // pairs tested so far this frame
+} GameMetrics;
+
+static const char* glObjectLabels[GPU_RESOURCE_KINDS] = {
+  "kind=\"vertex_array\"", "kind=\"buffer\"", "kind=\"program\"", "kind=\"texture\"",
+  "kind=\"framebuffer\"", "kind=\"renderbuffer\"", "kind=\"query\""
+};
+
+void initGameMetrics()
+{
+  // 0.5 ms to 250 ms, finer around the 60 and 30 fps frame times
+  static const double frame_buckets[] = { 0.0005, 0.001, 0.002, 0.004, 0.008, 0.0125, 0.0167, 0.02, 0.025, 0.0333, 0.05, 0.1, 0.25 };
+  static const double tick_buckets[] = { 0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025 };
+  GameMetrics.Frames = registerCounter("game_frames_total", "Frames drawn");
+  GameMetrics.FrameSeconds = registerHistogram("game_frame_seconds", "Frame time, pacing included",
+                                               frame_buckets, sizeof(frame_buckets)/sizeof(frame_buckets[0]));
+  GameMetrics.WorkSeconds = registerHistogram("game_frame_work_seconds", "Frame time before waiting on vsync or the limiter",
+                                              frame_buckets, sizeof(frame_buckets)/sizeof(frame_buckets[0]));
+  GameMetrics.TickSeconds = registerHistogram("game_tick_seconds", "Simulation tick time",
+                                              tick_buckets, sizeof(tick_buckets)/sizeof(tick_buckets[0]));
+  GameMetrics.CollisionPairs = registerGauge("game_collision_pairs", "Collision pairs tested in the last frame");
+  GameMetrics.CollisionPairsTotal = registerCounter("game_collision_pairs_total", "Collision pairs tested");
+  GameMetrics.DrawCalls = registerGauge("game_draw_calls", "Draw calls in the last frame");
+  for(int i=0;i<GPU_RESOURCE_KINDS;i++)
+    GameMetrics.GLObjects[i] = registerGauge("game_gl_objects", "Live GL objects", glObjectLabels[i]);
+  registerProcessMetrics();
 }
 
+/* Call once at the end of every frame, after the pacer and render stats have it */
+void updateGameMetrics()
+{
+  addCounter(GameMetrics.Frames);
+  observeHistogram(GameMetrics.FrameSeconds, Pacer.LastFrameTime);
+  observeHistogram(GameMetrics.WorkSeconds, Pacer.Work);
+  setGauge(GameMetrics.CollisionPairs, GameMetrics.FramePairs);
+  addCounter(GameMetrics.CollisionPairsTotal, GameMetrics.FramePairs);
+  GameMetrics.FramePairs = 0;
+  setGauge(GameMetrics.DrawCalls, RenderStats.Last.DrawCalls);
+  for(int i=0;i<GPU_RESOURCE_KINDS;i++)
+    setGauge(GameMetrics.GLObjects[i], GpuResources.live[i]);
+}
 
 void collision()
 {
+    PROFILE_ZONE("collision");
 
     int i=0;
       for(int j=1;j<no_objects;j++)
@@ -1112,35 +1209,43 @@ void collision()
 
         if(Objects[i]->isCircle)
         {
-            if(j<18)
+            // The hand made level's rectangles all come before index 18
+            if(j<18 || !hand_made_level)
             {
+            GameMetrics.FramePairs++;
             if(Objects[j]->isRectangle)
             {
 
-                if(abs(Objects[j]->origin[1]-Objects[i]->origin[1])<=Objects[i]->radius+Objects[j]->width && Objects[i]->origin[0]+Objects[i]->radius>Objects[j]->origin[0] && Objects[i]->origin[0]-Objects[i]->radius <= Objects[j]->origin[0]+Objects[j]->length && Objects[i]->origin[1]>Objects[j]->origin[1])
+                const VAO* b = Objects[i];
+                const VAO* r = Objects[j];
+                if(hitsRectangleTop(b->origin[0], b->origin[1], b->radius, r->origin[0], r->origin[1], r->length, r->width))
                 {
                     ball_y=Objects[j]->origin[1]+Objects[j]->width+Objects[i]->radius;
                     ball_velocity_y = -ball_velocity_y;
+                    GAME_PROBE3(contact, simulation_tick, j, PROBE_CONTACT_TOP);
 
                     Objects[j]->isMoving = 1;
                 //    Objectsy[j]->velocity_angular = 100;
                 }
-                if(Objects[j]->origin[1]>Objects[i]->origin[1] && abs(Objects[j]->origin[1]-Objects[i]->origin[1])<=Objects[i]->radius &&  Objects[i]->origin[0]+Objects[i]->radius>Objects[j]->origin[0] && Objects[i]->origin[0]-Objects[i]->radius <= Objects[j]->origin[0]+Objects[j]->length)
+                if(hitsRectangleBottom(b->origin[0], b->origin[1], b->radius, r->origin[0], r->origin[1], r->length, r->width))
                 {
                       ball_y = Objects[j]->origin[1]-Objects[i]->radius;
                       ball_velocity_y = -ball_velocity_y;
+                      GAME_PROBE3(contact, simulation_tick, j, PROBE_CONTACT_BOTTOM);
                     //  Objects[j]
 
                 }
-                if(Objects[i]->origin[0]<Objects[j]->origin[0] && Objects[j]->origin[0]-Objects[i]->origin[0]<=Objects[i]->radius && Objects[i]->origin[1] <= Objects[j]->origin[1]+Objects[j]->width && Objects[i]->origin[1]>=Objects[j]->origin[1])
+                if(hitsRectangleLeft(b->origin[0], b->origin[1], b->radius, r->origin[0], r->origin[1], r->length, r->width))
                 {
                     ball_velocity_x = -0.1*ball_velocity_x;
+                    GAME_PROBE3(contact, simulation_tick, j, PROBE_CONTACT_LEFT);
 
 
                 }
-                if(Objects[i]->origin[0]>Objects[j]->origin[0] && Objects[i]->origin[0]-Objects[j]->origin[0]<=Objects[i]->radius+Objects[j]->length && Objects[i]->origin[1] <= Objects[j]->origin[1]+Objects[j]->width && Objects[i]->origin[1]>=Objects[j]->origin[1])
+                if(hitsRectangleRight(b->origin[0], b->origin[1], b->radius, r->origin[0], r->origin[1], r->length, r->width))
                 {
                     ball_velocity_x = -0.1*ball_velocity_x;
+                    GAME_PROBE3(contact, simulation_tick, j, PROBE_CONTACT_RIGHT);
 
 
 
@@ -1150,16 +1255,12 @@ void collision()
             if(Objects[j]->isTarget)
             {
 
-                double x1 = Objects[i]->origin[0];
-                double y1 = Objects[i]->origin[1];
-                double x2 = Objects[j]->origin[0];
-                double y2 = Objects[j]->origin[1];
-                double dist = sqrt((y2-y1)*(y2-y1)+(x2-x1)*(x2-x1));
-                if(dist<Objects[i]->radius+Objects[j]->radius)
+                if(hitsCircle(Objects[i]->origin[0], Objects[i]->origin[1], Objects[i]->radius, Objects[j]->origin[0], Objects[j]->origin[1], Objects[j]->radius))
                 {
                      Objects[j]->origin[0]=5;
                      Objects[j]->origin[1]=5;
                      sco+=7-(7-chances-1);
+                     GAME_PROBE3(target_hit, simulation_tick, j, sco);
 
                 }
 
@@ -1171,15 +1272,11 @@ void collision()
             if(Objects[j]->isObstacle)
             {
 
-                double x1 = Objects[i]->origin[0];
-                double y1 = Objects[i]->origin[1];
-                double x2 = Objects[j]->origin[0];
-                double y2 = Objects[j]->origin[1];
-                double dist = sqrt((y2-y1)*(y2-y1)+(x2-x1)*(x2-x1));
-                if(dist<Objects[i]->radius+Objects[j]->radius)
+                if(hitsCircle(Objects[i]->origin[0], Objects[i]->origin[1], Objects[i]->radius, Objects[j]->origin[0], Objects[j]->origin[1], Objects[j]->radius))
                 {
                      ball_velocity_x = -0.5*ball_velocity_x;
                      ball_velocity_y = -0.5*ball_velocity_y;
+                     GAME_PROBE3(contact, simulation_tick, j, PROBE_CONTACT_OBSTACLE);
 
                 }
 
@@ -1191,56 +1288,110 @@ void collision()
 }
 }
 
-void draw ()
+/* Set up the static layer for a StaticLayerMode; auto starts timing with it on */
+void chooseStaticLayer (int mode)
 {
-  // clear the color and depth in the frame buffer
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  Matrices.projection = glm::ortho(-4.0f, float(4.0-display_x), -4.0f, float(4.0-display_y), 0.1f, 500.0f);
-
-
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
-
-  // Eye - Location of camera. Don't change unless you are sure!!
-  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-  // Target - Where is the camera looking at.  Don't change unless you are sure!!
-  glm::vec3 target (0, 0, 0);
-  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-  glm::vec3 up (0, 1, 0);
+  StaticCache.Enabled = mode != STATIC_LAYER_OFF;
+  StaticCache.Probe = mode == STATIC_LAYER_AUTO ? 0 : -1;
+  StaticCache.Cost[0] = StaticCache.Cost[1] = 0;
+}
 
-  // Compute Camera matrix (view)
-  // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-  //  Don't change unless you are sure!!
-  glfwGetCursorPos(window, &xpos, &ypos);
-//  ball_angle = ypos/xpos;
-  glfwGetFramebufferSize(window, &width, &height);
-  xpos=-4+(float)8.0/width*xpos;
-  ypos=-4+(float)8.0/height*ypos;
-  ypos*=-1;
-    //cout<<xpos<<" "<<ypos<<endl;
-  ball_angle = atan2 (ypos+3,xpos+3.75) * 180 / M_PI;
-  collision();
-  drawscore();
-  Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+/* --static-layer auto is still timing frames */
+int probingStaticLayer ()
+{
+  return StaticCache.Probe >= 0;
+}
 
-  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-  //  Don't change unless you are sure!!
-  glm::mat4 VP = Matrices.projection * Matrices.view;
+/* While probing, call once per frame with the time from the start of draw() to
+   the end of its rendering (glFinish). Picks the layer setting once both are timed */
+void probeStaticLayer (double seconds)
+{
+  int frame = StaticCache.Probe++ - STATIC_LAYER_PROBE_WARMUP;
+  if(frame < 0)
+    return;
+  int phase = frame % STATIC_LAYER_PROBE_FRAMES;
+  if(phase > 0)
+    StaticCache.Cost[StaticCache.Enabled] += seconds;
+  if(phase < STATIC_LAYER_PROBE_FRAMES-1)
+    return;
+  if(StaticCache.Enabled)
+  {
+    StaticCache.Enabled = 0;
+    return;
+  }
+  StaticCache.Enabled = StaticCache.Cost[1] <= StaticCache.Cost[0];
+  StaticCache.Probe = -1;
+  int timed = STATIC_LAYER_PROBE_FRAMES - 1;
+  printf("static layer : %s (%.3f ms a frame with it, %.3f ms without)\n", StaticCache.Enabled ? "on" : "off",
+         1000*StaticCache.Cost[1]/timed, 1000*StaticCache.Cost[0]/timed);
+}
 
-  // Send our transformation to the currently bound shader, in the "MVP" uniform
-  // For each model you render, since the MVP will be different (at least the M part)
-  //  Don't change unless you are sure!!
-  glm::mat4 MVP;	// MVP = Projection * View * Model
+/* Start the frame with the static layer : redraw it into its framebuffer if it
+   was invalidated, then copy it into the frame in place of clearing the colour.
+   With the layer off, clear and queue the static objects ahead of the scene */
+void drawStaticLayer ()
+{
+  if(!StaticCache.Enabled)
+  {
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    beginQueuedPass(PassTimers.StaticLayer);
+    for(int i=0;i<no_objects;i++)
+      if(Objects[i]->isStatic)
+        queueObject(Objects[i], Objects[i]->origin[0], Objects[i]->origin[1], Objects[i]->rotation_angle);
+    queueObject(base, -4.0f, -4.0f);
+    return;
+  }
 
+  beginGpuTimer(PassTimers.StaticLayer);
+  if(!StaticCache.Valid)
+  {
+    if(!StaticCache.Framebuffer.get() || StaticCache.Width!=frame_width || StaticCache.Height!=frame_height)
+      allocateStaticLayer();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, StaticCache.Framebuffer.get());
+    glClear(GL_COLOR_BUFFER_BIT);
+    // Everything is at z=0 and drawn in order, no depth needed
+    glDisable(GL_DEPTH_TEST);
+    countStateChanges(2);
+    for(int i=0;i<no_objects;i++)
+      if(Objects[i]->isStatic)
+        queueObject(Objects[i], Objects[i]->origin[0], Objects[i]->origin[1], Objects[i]->rotation_angle);
+    queueObject(base, -4.0f, -4.0f);
+    drawQueuedObjects();
+    glEnable(GL_DEPTH_TEST);
+    countStateChanges();
+    StaticCache.Valid = 1;
+  }
 
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, StaticCache.Framebuffer.get());
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frame_framebuffer);
+  glBlitFramebuffer(0, 0, StaticCache.Width, StaticCache.Height, 0, 0, frame_width, frame_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, frame_framebuffer);
+  countStateChanges(3);
+  glClear (GL_DEPTH_BUFFER_BIT);
+  endGpuTimer(PassTimers.StaticLayer);
+}
 
+/* A generated mover's step along its track, turning back at the ends. Its
+   rider goes along until it is hit (and parked at 5,5) */
+void moveOnTrack(VAO* mover)
+{
+  double step = mover->velocity_x*time_elapsed*60;
+  double& position = mover->origin[mover->moveAxis];
+  position += step;
+  if(mover->rider && mover->rider->origin[0] != 5)
+    mover->rider->origin[mover->moveAxis] += step;
+  if((position > mover->moveMax && step > 0) || (position < mover->moveMin && step < 0))
+    mover->velocity_x = -mover->velocity_x;
+}
 
-  // Load identity to model matrix
+/* Move the objects and the ball by one tick. No GL calls : the scaling benchmark
+   runs this without rendering */
+void updateObjects()
+{
+  PROFILE_ZONE("object loop");
   for(int i=0;i<no_objects;i++)
   {
-  Matrices.model = glm::mat4(1.0f);
-
   time_elapsed = 0.0004;
   if(Objects[i]->isMovable){
   //  cout << "hello " << endl;
@@ -1255,7 +1406,9 @@ void draw ()
 
   }
 }  /* Render your scene */
-if(i==12)
+if(Objects[i]->moveMax > Objects[i]->moveMin)
+  moveOnTrack(Objects[i]);
+if(i==12 && hand_made_level)
 {
     if(Objects[i]->isTarget)
     {
@@ -1277,7 +1430,7 @@ if(i==12)
     }
   }
 }
-if(i==14)
+if(i==14 && hand_made_level)
 {
     if(Objects[i]->isTarget)
     {
@@ -1299,7 +1452,7 @@ if(i==14)
     }
   }
 }
-if(i==16)
+if(i==16 && hand_made_level)
 {
     if(Objects[i]->isTarget)
     {
@@ -1322,47 +1475,138 @@ if(i==16)
 
     }
   }
-}
-  glm::mat4 translateObject = glm::translate (glm::vec3(Objects[i]->origin[0],Objects[i]->origin[1], 0.0f));
-  glm::mat4 rotateObject;
-  if(!Objects[i]->isObstacle){
-      rotateObject = glm::rotate((float)((Objects[i]->rotation_angle)*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
 }
   if(Objects[i]->isObstacle)
   {
-    rotateObject = glm::rotate((float)((Objects[i]->rotation_angle)*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
+      Objects[i]->rotation_angle+=5;
 
-//    glm::mat4 translateObject = glm::translate (glm::vec3(Objects[i]->origin[0],Objects[i]->origin[1], 0.0f));
-  } // glTranslatef
-  glm::mat4 ObjectTransform = translateObject*rotateObject;
-  Matrices.model = ObjectTransform;
-  MVP = VP * Matrices.model; // MVP = p * V * M
+  }
+}
 
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  if(flag==1){
+//  time_elapsed = current_time - last_update_time;
+  time_elapsed = 0.0004;
+  ball_velocity_y-=10*(time_elapsed*60);
+  ball_x+=ball_velocity_x*(time_elapsed*60);
+  ball_y+=ball_velocity_y*(time_elapsed*60)-5*time_elapsed*time_elapsed*3600 ;
+  }
+  if(ball_y<-4 || ball_x > 4 || ball_x<-4) 
+  {
+    flag=0;
+    ball_x = -3.75;
+    ball_y = -2.8;
+    if(chances<=0)
+      chances = -1;
+  }
+  ball->origin[0] = ball_x;
+  ball->origin[1] = ball_y;
+  ball->origin[2] = 0;
+}
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
+/* One tick of the game : collisions, then movement */
+void simulate()
+{
+  int64_t start = profileNow();
+  long pairs = GameMetrics.FramePairs;
+  (void) pairs;     // only read by the probe, which may be compiled out
+  collision();
+  updateObjects();
+  int64_t end = profileNow();
+  GAME_PROBE4(tick, simulation_tick, end - start, no_objects, GameMetrics.FramePairs - pairs);
+  double seconds = (end - start)*1e-9;
+  observeHistogram(GameMetrics.TickSeconds, seconds);
+  recordInputTick(seconds);
+  simulation_tick++;
+}
 
-  if(Objects[i]->isObstacle)
+/* Hand the replayed events due by now to the input callbacks, as glfwPollEvents would */
+void deliverReplayedInput()
+{
+  const InputEvent* e;
+  Input.Delivering = 1;
+  while((e = nextReplayedInput(simulation_tick)))
   {
-      Objects[i]->rotation_angle+=5;
-
+    if(e->Type == INPUT_KEY)
+      keyboard(window, e->Code, 0, e->Action, e->Mods);
+    else if(e->Type == INPUT_CHAR)
+      keyboardChar(window, e->Code);
+    else if(e->Type == INPUT_MOUSE)
+      mouseButton(window, e->Code, e->Action, e->Mods);
   }
-  draw3DObject(Objects[i]);
+  Input.Delivering = 0;
 }
-  Matrices.model = glm::mat4(1.0f);
 
-  glm::mat4 translateBase = glm::translate (glm::vec3(-4.0f, -4.0f, 0.0f)); // glTranslatef
-  //glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-  glm::mat4 BaseTransform = translateBase;
-  Matrices.model *= BaseTransform;
-  MVP = VP * Matrices.model; // MVP = p * V * M
+void finishInputSession()
+{
+  finishInput(simulation_tick, sco, chances, ball_x, ball_y);
+}
+
+void draw ()
+{
+  PROFILE_ZONE("draw");
+  Matrices.projection = glm::ortho(-4.0f, float(4.0-display_x), -4.0f, float(4.0-display_y), 0.1f, 500.0f);
+  setViewRectangle(-4.0f, -4.0f, float(4.0-display_x), float(4.0-display_y));
+  // The projection maps the view's width to 2 in clip space, then to frame_width pixels
+  view_pixels_per_unit = Matrices.projection[0][0]*frame_width/2;
+
+
+  // use the loaded shader program
+  // Don't change unless you know what you are doing
+  glUseProgram (program.get());
+  countStateChanges();
+
+  // Eye - Location of camera. Don't change unless you are sure!!
+  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
+  // Target - Where is the camera looking at.  Don't change unless you are sure!!
+  glm::vec3 target (0, 0, 0);
+  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
+  glm::vec3 up (0, 1, 0);
 
+  // Compute Camera matrix (view)
+  // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
   //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  if(window)
+  {
+    glfwGetCursorPos(window, &xpos, &ypos);
+//  ball_angle = ypos/xpos;
+    glfwGetFramebufferSize(window, &width, &height);
+  }
+  else
+  {
+    // No pointer when headless, aim at the middle of the screen
+    xpos = width/2.0;
+    ypos = height/2.0;
+  }
+  xpos=-4+(float)8.0/width*xpos;
+  ypos=-4+(float)8.0/height*ypos;
+  ypos*=-1;
+  sampleInputCursor(simulation_tick, &xpos, &ypos);
+    //cout<<xpos<<" "<<ypos<<endl;
+  ball_angle = atan2 (ypos+3,xpos+3.75) * 180 / M_PI;
+  simulate();
+  drawscore();
+  Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+
+  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
+  //  Don't change unless you are sure!!
+  glm::mat4 VP = Matrices.projection * Matrices.view;
+
+  // Send our transformation to the currently bound shader, in the "VP" uniform
+  // The model part of every object is queued below and uploaded once per frame
+  //  Don't change unless you are sure!!
+  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &VP[0][0]);
+  countStateChanges();
+
+  // The background and everything that never moves come from the static layer
+  drawStaticLayer();
+
+  beginQueuedPass(PassTimers.Scene);
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(base);
+
+  // Model transform = translate to origin * rotate about z
+  for(int i=0;i<no_objects;i++)
+    if(!Objects[i]->isStatic)
+      queueObject(Objects[i], Objects[i]->origin[0], Objects[i]->origin[1], Objects[i]->rotation_angle);
 
 /*  Matrices.model = glm::mat4(1.0f);
 
@@ -1384,49 +1628,22 @@ if(i==16)
   // Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
   // glPopMatrix ();
   Matrices.model = glm::mat4(1.0f);
-  if(flag==1){
-//  time_elapsed = current_time - last_update_time;
-  time_elapsed = 0.0004;
-  ball_velocity_y-=10*(time_elapsed*60);
-  ball_x+=ball_velocity_x*(time_elapsed*60);
-  ball_y+=ball_velocity_y*(time_elapsed*60)-5*time_elapsed*time_elapsed*3600 ;
-  }
-  if(ball_y<-4 || ball_x > 4 || ball_x<-4) 
-  {
-    flag=0;
-    ball_x = -3.75;
-    ball_y = -2.8;
-    if(chances<=0)
-      chances = -1;
-  }
-for(int i=0;i<no_scoelements;i++)
-{
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateScore  = glm::translate (glm::vec3(0,0,0));        // glTranslatef
-  Matrices.model *= translateScore;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(scoElements[i]);
-
-}
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  ball->origin[0] = ball_x;
-  ball->origin[1] = ball_y;
-  ball->origin[2] = 0;
   // Increment angles
 
   float increments = 1;
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateRotator  = glm::translate (glm::vec3(-3.75,-3, 0));        // glTranslatef
-  glm::mat4 rotateRotator = glm::rotate((float)(ball_angle*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model = translateRotator*rotateRotator;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  beginQueuedPass(PassTimers.Rotator);
+  queueObject(Rotator, -3.75, -3, ball_angle);
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(Rotator);
+  // Upload all the transforms of this frame once and draw the queued objects
+  drawQueuedObjects();
 
+  // All the text of the frame goes out in one draw, over the scene, with the overlay
+  drawStatsText();
+  if (Options.overlay)
+    queuePerfOverlay(frame_width, frame_height, frame_height - 3*8*max(1, frame_height/500));
+  beginGpuTimer(PassTimers.Text);
+  drawQueuedText(frame_width, frame_height);
+  endGpuTimer(PassTimers.Text);
 
 
   //camera_rotation_angle++; // Simulating camera rotation
@@ -1440,6 +1657,20 @@ for(int i=0;i<no_scoelements;i++)
 
 }
 
+void reportStats()
+{
+    printFrameTimeSummary();
+    printGpuTimerSummary();
+    printMeshStats();
+    long long tested = Culling.Queued + Culling.Culled;
+    printf("culling: %lld objects queued, %lld culled (%.1lf%%), %d culled in the last frame\n",
+           Culling.Queued, Culling.Culled, tested ? 100.0*Culling.Culled/tested : 0.0, Culling.FrameCulled);
+    printStreamBufferStats("transform", &Transforms.Stream);
+    printTextStats();
+    printGpuResources();
+    printAllocationSummary();
+}
+
 /* Initialise glfw window, I/O callbacks and the renderer to use */
 /* Nothing to Edit here */
 GLFWwindow* initGLFW (int width, int height)
@@ -1466,7 +1697,7 @@ GLFWwindow* initGLFW (int width, int height)
 
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-    glfwSwapInterval( 1 );
+    applyVsync(Options.vsync >= 0 ? (VsyncMode) Options.vsync : Options.benchmarkFrames ? VSYNC_OFF : VSYNC_ON);
 
     /* --- register callbacks with GLFW --- */
 
@@ -1496,40 +1727,26 @@ void initGL (GLFWwindow* window, int width, int height)
     /* Objects should be created before any other gl function and shaders */
 	// Create the models
 	//createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-	createBall ();
-  createBase();
-  createRotator();
-  createPlateform();
-  createRectangle(1,0.5,-2,-2,0,0);
-  createRectangle(1,0.5,0,-3,0,0);
-  createTarget(3,-2,0.2,0,0);
-  createTarget(3,1.5,0.2,0,0);
-  createObstacles(-1.5,0);
-  createObstacles(-1.5,2.5);
-  createTarget(0.9,1.5,0.2,0,0);
-  createRectangle(1,0.5,2,-1,0,0);
-  createTarget(3.8,-0.25,0.2,0,0);
-  createTarget(-1.5,1.25,0.2,0,0);
-  createRectangle(1,0.4,-1,0.6,0.5,1);
-  createTarget(-0.5,1.2,0.2,0.5,1);
-  createRectangle(1,0.4,1,0.6,0.5,1);
-  createTarget(1.5,1.2,0.2,0.5,1);
-  createRectangle(1,0.4,-3.1,0,0.5,1);
-  createTarget(-2.5,0.6,0.2,0.5,1);
-  createTarget(-3.9,3.8,0.1,0,0);
-  createTarget(-3.9,3.6,0.1,0,0);
-  createTarget(-3.9,3.4,0.1,0,0);
-  createTarget(-3.9,3.2,0.1,0,0);
-  createTarget(-3.9,3,0.1,0,0);
-  createTarget(-3.9,2.8,0.1,0,0);
-  createTarget(-3.9,2.6,0.1,0,0);
-
-//  createScore(3,3,1);
+	createScene(Options.bodies, Options.level);
+
 
 	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	program = GLProgram::adopt(LoadShaders( "Sample_GL.vert", "Sample_GL.frag" ));
+	// Get a handle for our "VP" uniform and the per-object transform lookup
+	Matrices.MatrixID = glGetUniformLocation(program.get(), "VP");
+	Matrices.ObjectBaseID = glGetUniformLocation(program.get(), "ObjectBase");
+	Matrices.TransformsID = glGetUniformLocation(program.get(), "ObjectTransforms");
+	initTransformBuffer();
+	PassTimers.StaticLayer = createGpuTimer("gpu static layer");
+	PassTimers.Scene = createGpuTimer("gpu scene");
+	PassTimers.Rotator = createGpuTimer("gpu rotator");
+	PassTimers.Text = createGpuTimer("gpu text");
+	initText(LoadShaders( "Text_GL.vert", "Text_GL.frag" ));
+	// A benchmark keeps the layer on : probing would time layer-off frames into its results
+	if (Options.benchmarkFrames && Options.staticLayer == STATIC_LAYER_AUTO)
+		chooseStaticLayer(STATIC_LAYER_ON);
+	else
+		chooseStaticLayer(Options.staticLayer);
 
 
 	reshapeWindow (window, width, height);
@@ -1538,8 +1755,10 @@ void initGL (GLFWwindow* window, int width, int height)
 	glClearColor (0.3f, 0.3f, 0.3f, 0.0f); // R, G, B, A
 	glClearDepth (1.0f);
 //  glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-  GLFWcursor* cursor = glfwCreateStandardCursor(GLFW_CROSSHAIR_CURSOR);
-  glfwSetCursor(window, cursor);
+  if (window) {
+    GLFWcursor* cursor = glfwCreateStandardCursor(GLFW_CROSSHAIR_CURSOR);
+    glfwSetCursor(window, cursor);
+  }
 	glEnable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
 
@@ -1549,36 +1768,292 @@ void initGL (GLFWwindow* window, int width, int height)
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
-int main (int argc, char** argv)
+void usage (const char* program_name)
+{
+    printf("usage: %s [options]\n", program_name);
+    printf("  --headless           render offscreen with EGL, no window or display needed\n");
+    printf("  --size WxH           framebuffer size (default %dx%d)\n", width, height);
+    printf("  --frames N           quit after N frames\n");
+    printf("  --dump-frames DIR    save frames as DIR/frame_NNNNNN.ppm\n");
+    printf("  --dump-interval N    save every Nth frame (default 1)\n");
+    printf("  --capture PATH       record to PATH.y4m, or to PATH/capture_NNNNNN.ppm\n");
+    printf("  --capture-fps N      frame rate stored in the .y4m header (default 60)\n");
+    printf("  --capture-delay N    frames between readback and writing (default 3)\n");
+    printf("  --vsync MODE         on, off or adaptive (default on, off with --benchmark)\n");
+    printf("  --fps-limit N        cap the frame rate at N fps, 0 = no limit\n");
+    printf("  --benchmark N        run uncapped, time N frames after %d warmup frames and quit\n", BENCHMARK_WARMUP_FRAMES);
+    printf("  --debug-text         show timings and culling on screen (F3 toggles)\n");
+    printf("  --overlay            show the performance overlay (F4 toggles)\n");
+    printf("  --static-layer MODE  on, off or auto : copy the static objects from a cached layer (default on)\n");
+    printf("  --bodies N           play a scene of N objects : the level cut short or tiled\n");
+    printf("  --level-seed N       play a generated level (default seed 1); any of the options below also does\n");
+    printf("  --rectangles N       static rectangles in it (default 5)\n");
+    printf("  --targets N          targets (default 10)\n");
+    printf("  --obstacles N        spinning obstacles (default 3)\n");
+    printf("  --movers N           moving rectangles carrying a target (default 3)\n");
+    printf("  --density F          part of the play area the bodies cover, they shrink to fit (default 0.08)\n");
+    printf("  --distribution NAME  uniform, clustered or grid (default uniform)\n");
+    printf("  --trace PATH         write the last seconds of CPU profile zones to PATH at exit (F2 : any time)\n");
+    printf("  --trace-seconds N    how far back traces go (default %d)\n", PROFILE_DEFAULT_SECONDS);
+    printf("  --metrics ADDRESS    serve Prometheus metrics over HTTP on unix:PATH or [localhost:]PORT\n");
+    printf("  --metrics-snapshot PATH  append a metrics snapshot to PATH every interval\n");
+    printf("  --metrics-interval S seconds between snapshots and recent quantiles (default %d)\n", METRICS_DEFAULT_INTERVAL);
+    printf("  --record PATH        record the keys, mouse buttons and aim to PATH\n");
+    printf("  --replay PATH        play the level and input recorded in PATH, then quit with its timing\n");
+    printf("  --config PATH        read options from PATH instead of game.cfg\n");
+    printf("Options can also be given in game.cfg, one per line without the dashes, e.g. \"vsync off\"\n");
+}
+
+void loadConfig (const char* path, int required);
+
+int parseStaticLayerMode (const char* name)
+{
+    for (int i=0; i<3; i++)
+        if (!strcmp(name, staticLayerModeNames[i]))
+            return i;
+    return -1;
+}
+
+void parseOptions (int argc, char** argv)
+{
+    for (int i=1; i<argc; i++) {
+        const char* arg = argv[i];
+        int has_value = i+1 < argc;
+        if (!strcmp(arg, "--headless"))
+            Options.headless = 1;
+        else if (!strcmp(arg, "--size") && has_value && sscanf(argv[i+1], "%dx%d", &width, &height) == 2)
+            i++;
+        else if (!strcmp(arg, "--frames") && has_value)
+            Options.frames = atol(argv[++i]);
+        else if (!strcmp(arg, "--dump-frames") && has_value)
+            Options.dumpDirectory = argv[++i];
+        else if (!strcmp(arg, "--dump-interval") && has_value)
+            Options.dumpInterval = max(atoi(argv[++i]), 1);
+        else if (!strcmp(arg, "--capture") && has_value)
+            Options.capturePath = argv[++i];
+        else if (!strcmp(arg, "--capture-fps") && has_value)
+            Options.captureFps = max(atoi(argv[++i]), 1);
+        else if (!strcmp(arg, "--capture-delay") && has_value)
+            Options.captureDelay = max(atoi(argv[++i]), 1);
+        else if (!strcmp(arg, "--vsync") && has_value && (Options.vsync = parseVsyncMode(argv[i+1])) >= 0)
+            i++;
+        else if (!strcmp(arg, "--fps-limit") && has_value)
+            Options.fpsLimit = max(atof(argv[++i]), 0.0);
+        else if (!strcmp(arg, "--benchmark") && has_value)
+            Options.benchmarkFrames = max(atol(argv[++i]), 1L);
+        else if (!strcmp(arg, "--debug-text"))
+            Options.debugText = 1;
+        else if (!strcmp(arg, "--overlay"))
+            Options.overlay = 1;
+        else if (!strcmp(arg, "--static-layer") && has_value && (Options.staticLayer = parseStaticLayerMode(argv[i+1])) >= 0)
+            i++;
+        else if (!strcmp(arg, "--bodies") && has_value)
+            Options.bodies = max(atoi(argv[++i]), 0);
+        else if (!strcmp(arg, "--level-seed") && has_value)
+            Options.level.Generate = 1, Options.level.Seed = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(arg, "--rectangles") && has_value)
+            Options.level.Generate = 1, Options.level.Rectangles = max(atoi(argv[++i]), 0);
+        else if (!strcmp(arg, "--targets") && has_value)
+            Options.level.Generate = 1, Options.level.Targets = max(atoi(argv[++i]), 0);
+        else if (!strcmp(arg, "--obstacles") && has_value)
+            Options.level.Generate = 1, Options.level.Obstacles = max(atoi(argv[++i]), 0);
+        else if (!strcmp(arg, "--movers") && has_value)
+            Options.level.Generate = 1, Options.level.Movers = max(atoi(argv[++i]), 0);
+        else if (!strcmp(arg, "--density") && has_value)
+            Options.level.Generate = 1, Options.level.Density = min(max(atof(argv[++i]), 0.001), 1.0);
+        else if (!strcmp(arg, "--distribution") && has_value && parseLevelDistribution(argv[i+1]) >= 0)
+            Options.level.Generate = 1, Options.level.Distribution = (LevelDistribution) parseLevelDistribution(argv[++i]);
+        else if (!strcmp(arg, "--trace") && has_value)
+            Options.tracePath = argv[++i];
+        else if (!strcmp(arg, "--trace-seconds") && has_value)
+            Options.traceSeconds = max(atof(argv[++i]), 0.0);
+        else if (!strcmp(arg, "--metrics") && has_value)
+            Options.metricsEndpoint = argv[++i];
+        else if (!strcmp(arg, "--metrics-snapshot") && has_value)
+            Options.metricsSnapshot = argv[++i];
+        else if (!strcmp(arg, "--metrics-interval") && has_value)
+            Options.metricsInterval = max(atof(argv[++i]), 0.1);
+        else if (!strcmp(arg, "--record") && has_value)
+            Options.recordPath = argv[++i];
+        else if (!strcmp(arg, "--replay") && has_value)
+            Options.replayPath = argv[++i];
+        else if (!strcmp(arg, "--config") && has_value)
+            loadConfig(argv[++i], 1);
+        else {
+            usage(argv[0]);
+            exit(strcmp(arg, "--help") ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+
+}
+
+/* Read options from a config file : one "name value" per line, # starts a comment.
+   The strings have to outlive the parse, Options keeps pointers into them, so they
+   live in a deque : a later config appending to it doesn't move the earlier ones */
+void loadConfig (const char* path, int required)
 {
+    static std::deque<std::string> words;
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        if (required) {
+            fprintf(stderr, "Error: could not read config %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    size_t first = words.size();
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string name, value;
+        if (!(fields >> name))
+            continue;
+        words.push_back("--" + name);
+        if (fields >> value)
+            words.push_back(value);
+    }
+
+    std::vector<char*> args(1, (char*) path);
+    for (size_t i = first; i < words.size(); i++)
+        args.push_back(&words[i][0]);
+    parseOptions(args.size(), &args[0]);
+}
 
+#ifdef GAME_BENCH
+#include "bench.h"
+#include "perf_gate.h"
+#endif
 
-   window = initGLFW(width, height);
+int main (int argc, char** argv)
+{
+#ifdef GAME_BENCH
+    if (argc > 1 && !strcmp(argv[1], "gate"))
+        exit(perfGateMain(argc - 1, argv + 1));
+    exit(benchMain(argc, argv));
+#endif
+    // Command line options come last so they override the config file
+    int has_config = 0;
+    for (int i=1; i<argc; i++)
+        has_config |= !strcmp(argv[i], "--config");
+    if (!has_config)
+        loadConfig("game.cfg", 0);
+    parseOptions(argc, argv);
+    if (Options.benchmarkFrames)
+        Options.frames = BENCHMARK_WARMUP_FRAMES + Options.benchmarkFrames;
+    if (Options.replayPath) {
+        if (!startInputReplay(Options.replayPath))
+            exit(EXIT_FAILURE);
+        Options.bodies = Input.Session.Bodies;
+        Options.level = Input.Session.Level;
+    }
+    else if (Options.recordPath && !startInputRecording(Options.recordPath, Options.bodies, Options.level))
+        exit(EXIT_FAILURE);
+    if (Options.headless && Options.frames == 0 && Options.dumpDirectory && !Options.replayPath)
+        printf("Headless run without --frames, stop it with Ctrl-C\n");
+
+    if (Options.headless) {
+        if (!initHeadless())
+            exit(EXIT_FAILURE);
+        window = NULL;
+        frame_framebuffer = createOffscreenTarget(width, height);
+    }
+    else {
+        window = initGLFW(width, height);
+    }
 
 	initGL (window, width, height);
+    if (Options.dumpDirectory)
+        mkdir(Options.dumpDirectory, 0755);
+    if (Options.capturePath && !startCapture(Options.capturePath, frame_width, frame_height, Options.captureFps, Options.captureDelay))
+        exit(EXIT_FAILURE);
+    if (Options.metricsEndpoint || Options.metricsSnapshot) {
+        initGameMetrics();
+        if (!startMetrics(Options.metricsEndpoint, Options.metricsSnapshot, Options.metricsInterval))
+            exit(EXIT_FAILURE);
+    }
 
 //    double last_update_time = glfwGetTime(), current_time;
 
+    initFramePacer(Options.fpsLimit, Options.benchmarkFrames);
+    setProfileThreadName("main");
+    Profiler.Seconds = Options.traceSeconds;
+
+    GAME_PROBE4(level_loaded, no_objects, generated_level, Options.level.Seed, level_checksum);
+
     /* Draw in loop */
-    while (!glfwWindowShouldClose(window)) {
+    long frame = 0;
+    while (window ? !glfwWindowShouldClose(window) : 1) {
+        beginFrame();
+        GAME_PROBE1(frame_start, frame);
+        recordPerfOverlayFrame();
+        PROFILE_ZONE("frame");
 
         // OpenGL Draw commands
 //        last_update_time = glfwGetTime();
-        current_time = glfwGetTime();
+        current_time = gameTime();
         //if(chances<0)
         //  break;
+        double draw_start = gameTime();
         draw();
+        // --static-layer auto times its first frames to the end of their rendering
+        if (probingStaticLayer()) {
+            glFinish();
+            probeStaticLayer(gameTime() - draw_start);
+        }
         if(chances==-1)
           break;
 
+        if (Options.dumpDirectory && frame % Options.dumpInterval == 0) {
+            AllocationExemption exempt;
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/frame_%06ld.ppm", Options.dumpDirectory, frame);
+            dumpFrame(path, frame_framebuffer, frame_width, frame_height);
+        }
+        captureFrame(frame_framebuffer, frame_width, frame_height);
+
         //collision();
-        last_update_time = glfwGetTime();
+        last_update_time = gameTime();
+        endFrameWork();
 
-        // Swap Frame Buffer in double buffering
-        glfwSwapBuffers(window);
+        if (window) {
+            // Swap Frame Buffer in double buffering
+            {
+                PROFILE_ZONE("glfwSwapBuffers");
+                glfwSwapBuffers(window);
+            }
 
-        // Poll for Keyboard and mouse events
-        glfwPollEvents();
+            // Poll for Keyboard and mouse events
+            {
+                PROFILE_ZONE("glfwPollEvents");
+                glfwPollEvents();
+            }
+        }
+        else if (Options.benchmarkFrames)
+            glFinish();     // nothing else waits for the GPU here, time the whole frame
+        else
+            glFlush();
+        if (Options.replayPath)
+            deliverReplayedInput();
+        limitFrameRate();
+        finishFrame(!Options.benchmarkFrames || frame >= BENCHMARK_WARMUP_FRAMES);
+
+        collectGpuTimers();
+
+        // Nothing should be creating GL objects frame after frame
+        checkGpuResourceGrowth();
+        // ... nor allocating memory
+        endFrameAllocations();
+        endRenderStatsFrame();
+        updateGameMetrics();
+        GAME_PROBE4(frame_end, frame, (long) (1e9*Pacer.LastFrameTime), (long) (1e9*Pacer.Work), RenderStats.Last.DrawCalls);
+
+        frame++;
+        if (Options.frames && frame >= Options.frames)
+            break;
+        if (inputReplayFinished(simulation_tick))
+            break;
 
         // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
     //    current_time = glfwGetTime(); // Time in seconds
@@ -1589,6 +2064,20 @@ int main (int argc, char** argv)
   //      }
     }
 
-    glfwTerminate();
+    stopCapture();
+    stopMetrics();
+    if (Options.tracePath)
+        writeProfileTrace(Options.tracePath);
+    finishInputSession();
+    reportStats();
+    if (window) {
+        releaseGpuContext();
+        glfwTerminate();
+    }
+    else {
+        glFinish();
+        releaseGpuContext();
+        destroyHeadless();
+    }
     exit(EXIT_SUCCESS);
 }
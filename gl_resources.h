@@ -0,0 +1,191 @@
+#ifndef GL_RESOURCES_H
+#define GL_RESOURCES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glad/glad.h>
+
+#include "alloc_tracker.h"
+
+/* Every GL object the game creates goes through here, so we always know how
+   many of each kind are alive and how much memory they hold.
+   Build with -DGPU_RESOURCE_DEBUG to abort as soon as the live counts grow
+   from one frame to the next (see checkGpuResourceGrowth) */
+
+enum GpuResourceKind {
+    GPU_VERTEX_ARRAY,
+    GPU_BUFFER,
+    GPU_PROGRAM,
+    GPU_TEXTURE,
+    GPU_FRAMEBUFFER,
+    GPU_RENDERBUFFER,
+    GPU_QUERY,
+    GPU_RESOURCE_KINDS
+};
+
+static const char* gpuResourceNames[GPU_RESOURCE_KINDS] = { "vertex arrays", "buffers", "programs", "textures", "framebuffers", "renderbuffers", "queries" };
+
+struct GpuResourceRegistry {
+    long live[GPU_RESOURCE_KINDS];
+    long long bytes[GPU_RESOURCE_KINDS];
+    long long created[GPU_RESOURCE_KINDS];  // over the whole session
+    long lastLive[GPU_RESOURCE_KINDS];      // at the end of the previous frame
+    long frames;
+    int contextAlive;                       // GL calls are only made while this is set
+} GpuResources = { {0}, {0}, {0}, {0}, 0, 1 };
+
+/* Frames allowed to create objects before growth checks start */
+#define GPU_RESOURCE_WARMUP_FRAMES 2
+
+void gpuResourceCreated (GpuResourceKind kind, long long bytes=0)
+{
+    GpuResources.live[kind]++;
+    GpuResources.created[kind]++;
+    trackGLObjectCreated();
+    GpuResources.bytes[kind] += bytes;
+}
+
+void gpuResourceDestroyed (GpuResourceKind kind, long long bytes=0)
+{
+    GpuResources.live[kind]--;
+    GpuResources.bytes[kind] -= bytes;
+}
+
+void gpuResourceResized (GpuResourceKind kind, long long old_bytes, long long new_bytes)
+{
+    GpuResources.bytes[kind] += new_bytes - old_bytes;
+}
+
+/* Call before the context goes away; handles released later only forget their GL names */
+void releaseGpuContext ()
+{
+    GpuResources.contextAlive = 0;
+}
+
+/* Accept the current live counts as the new baseline, e.g. after loading a level */
+void rebaselineGpuResources ()
+{
+    for (int i=0; i<GPU_RESOURCE_KINDS; i++)
+        GpuResources.lastLive[i] = GpuResources.live[i];
+}
+
+/* Call once at the end of every frame */
+void checkGpuResourceGrowth ()
+{
+    GpuResources.frames++;
+    for (int i=0; i<GPU_RESOURCE_KINDS; i++) {
+        if (GpuResources.frames > GPU_RESOURCE_WARMUP_FRAMES && GpuResources.live[i] > GpuResources.lastLive[i]) {
+            fprintf(stderr, "GPU resource leak: %ld live %s at frame %ld, %ld at the frame before\n",
+                    GpuResources.live[i], gpuResourceNames[i], GpuResources.frames, GpuResources.lastLive[i]);
+#ifdef GPU_RESOURCE_DEBUG
+            abort();
+#endif
+        }
+        GpuResources.lastLive[i] = GpuResources.live[i];
+    }
+}
+
+void printGpuResources ()
+{
+    for (int i=0; i<GPU_RESOURCE_KINDS; i++)
+        printf("GPU %s: %ld live (%lld bytes), %lld created\n",
+               gpuResourceNames[i], GpuResources.live[i], GpuResources.bytes[i], GpuResources.created[i]);
+}
+
+/* Owning handle to a GL object of the given kind : the object is deleted with
+   the handle. Handles can be moved but not copied, and start out empty so they
+   can live in globals created before the GL context */
+template <GpuResourceKind Kind>
+class GLObject {
+public:
+    GLObject () : id(0), bytes(0) {}
+    ~GLObject () { release(); }
+    GLObject (GLObject&& other) : id(other.id), bytes(other.bytes) { other.id = 0; other.bytes = 0; }
+    GLObject& operator= (GLObject&& other) {
+        if (this != &other) {
+            release();
+            id = other.id;
+            bytes = other.bytes;
+            other.id = 0;
+            other.bytes = 0;
+        }
+        return *this;
+    }
+    GLObject (const GLObject&) = delete;
+    GLObject& operator= (const GLObject&) = delete;
+
+    /* Create a new GL object */
+    static GLObject generate () {
+        GLuint name = 0;
+        switch (Kind) {
+            case GPU_VERTEX_ARRAY: glGenVertexArrays(1, &name); break;
+            case GPU_BUFFER:       glGenBuffers(1, &name); break;
+            case GPU_TEXTURE:      glGenTextures(1, &name); break;
+            case GPU_PROGRAM:      name = glCreateProgram(); break;
+            case GPU_FRAMEBUFFER:  glGenFramebuffers(1, &name); break;
+            case GPU_RENDERBUFFER: glGenRenderbuffers(1, &name); break;
+            case GPU_QUERY:        glGenQueries(1, &name); break;
+            default: break;
+        }
+        return adopt(name);
+    }
+
+    /* Take ownership of an object created elsewhere */
+    static GLObject adopt (GLuint name) {
+        GLObject object;
+        object.id = name;
+        if (name)
+            gpuResourceCreated(Kind);
+        return object;
+    }
+
+    GLuint get () const { return id; }
+
+    /* Record how much memory the object's data store holds */
+    void setSize (long long size) {
+        gpuResourceResized(Kind, bytes, size);
+        bytes = size;
+    }
+
+private:
+    void release () {
+        if (!id)
+            return;
+        if (GpuResources.contextAlive) {
+            switch (Kind) {
+                case GPU_VERTEX_ARRAY: glDeleteVertexArrays(1, &id); break;
+                case GPU_BUFFER:       glDeleteBuffers(1, &id); break;
+                case GPU_TEXTURE:      glDeleteTextures(1, &id); break;
+                case GPU_PROGRAM:      glDeleteProgram(id); break;
+                case GPU_FRAMEBUFFER:  glDeleteFramebuffers(1, &id); break;
+                case GPU_RENDERBUFFER: glDeleteRenderbuffers(1, &id); break;
+                case GPU_QUERY:        glDeleteQueries(1, &id); break;
+                default: break;
+            }
+        }
+        gpuResourceDestroyed(Kind, bytes);
+        id = 0;
+        bytes = 0;
+    }
+
+    GLuint id;
+    long long bytes;
+};
+
+typedef GLObject<GPU_VERTEX_ARRAY> GLVertexArray;
+typedef GLObject<GPU_BUFFER> GLBuffer;
+typedef GLObject<GPU_TEXTURE> GLTexture;
+typedef GLObject<GPU_PROGRAM> GLProgram;
+typedef GLObject<GPU_FRAMEBUFFER> GLFramebuffer;
+typedef GLObject<GPU_RENDERBUFFER> GLRenderbuffer;
+typedef GLObject<GPU_QUERY> GLQuery;
+
+/* glBufferData that keeps the registry's byte count in step */
+void bufferData (GLBuffer& buffer, GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    glBindBuffer(target, buffer.get());
+    glBufferData(target, size, data, usage);
+    buffer.setSize(size);
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <stdio.h>
+#include <vector>
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+#include "frame_pacing.h"
+
+/* Named GPU timing scopes measured with GL_TIME_ELAPSED queries (core since
+   GL 3.3, llvmpipe has them too). Each scope owns GPU_TIMER_LATENCY queries
+   used round robin : a result is only read GPU_TIMER_LATENCY-1 frames after it
+   was issued, and only if it is already available, so reading never stalls.
+   Results late beyond that are dropped and counted.
+   GL_TIME_ELAPSED queries can't nest : scopes must not overlap */
+
+#define GPU_TIMER_LATENCY 2     // double buffered
+
+/* Results of the first frames are thrown away : they include context start up,
+   and llvmpipe reports nonsense (time since boot) for its very first query */
+#define GPU_TIMER_WARMUP_FRAMES 1
+
+struct GpuTimer {
+    const char* Name;
+    GLQuery Queries[GPU_TIMER_LATENCY];
+    int Pending[GPU_TIMER_LATENCY];     // query issued, result not read yet
+    std::vector<float> Samples;         // seconds, ring of the last Samples.size() results
+    long long Count;                    // results read
+    long long Dropped;                  // results not ready in time
+};
+
+struct GpuTimerSet {
+    std::vector<GpuTimer> Timers;
+    int Slot;                           // query slot used this frame
+    int Active;                         // timer between begin and end, -1 = none
+    size_t History;
+    long long Frames;                   // frames collected
+} GpuTimers = { std::vector<GpuTimer>(), 0, -1, FRAME_TIME_HISTORY, 0 };
+
+/* Create a scope; returns its id for beginGpuTimer / endGpuTimer */
+int createGpuTimer (const char* name)
+{
+    GpuTimers.Timers.push_back(GpuTimer());
+    GpuTimer& timer = GpuTimers.Timers.back();
+    timer.Name = name;
+    for (int i=0; i<GPU_TIMER_LATENCY; i++) {
+        timer.Queries[i] = GLQuery::generate();
+        timer.Pending[i] = 0;
+    }
+    timer.Samples.assign(GpuTimers.History, 0.0f);
+    timer.Count = 0;
+    timer.Dropped = 0;
+    return GpuTimers.Timers.size() - 1;
+}
+
+/* id < 0 is ignored, so callers can pass "no timer" through */
+void beginGpuTimer (int id)
+{
+    if (id < 0)
+        return;
+    GpuTimer& timer = GpuTimers.Timers[id];
+    if (GpuTimers.Active >= 0 || timer.Pending[GpuTimers.Slot])
+        return;     // already timed this frame, or nested in another scope
+    glBeginQuery(GL_TIME_ELAPSED, timer.Queries[GpuTimers.Slot].get());
+    GpuTimers.Active = id;
+}
+
+void endGpuTimer (int id)
+{
+    if (id < 0 || GpuTimers.Active != id)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    GpuTimers.Timers[id].Pending[GpuTimers.Slot] = 1;
+    GpuTimers.Active = -1;
+}
+
+/* Call once at the end of every frame : read back the results of the slot the
+   next frame will reuse, without waiting for any that aren't ready */
+void collectGpuTimers ()
+{
+    GpuTimers.Slot = (GpuTimers.Slot + 1) % GPU_TIMER_LATENCY;
+    GpuTimers.Frames++;
+    // The results about to be read are from frame Frames - GPU_TIMER_LATENCY
+    int keep = GpuTimers.Frames - GPU_TIMER_LATENCY >= GPU_TIMER_WARMUP_FRAMES;
+    for (size_t i=0; i<GpuTimers.Timers.size(); i++) {
+        GpuTimer& timer = GpuTimers.Timers[i];
+        int slot = GpuTimers.Slot;
+        if (!timer.Pending[slot])
+            continue;
+        timer.Pending[slot] = 0;
+
+        GLint available = 0;
+        glGetQueryObjectiv(timer.Queries[slot].get(), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            timer.Dropped++;
+            continue;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timer.Queries[slot].get(), GL_QUERY_RESULT, &elapsed);
+        if (!keep)
+            continue;
+        timer.Samples[timer.Count % timer.Samples.size()] = elapsed*1e-9f;
+        timer.Count++;
+    }
+}
+
+/* Most recent result of a scope in seconds, 0 before the first one */
+float lastGpuTime (int id)
+{
+    if (id < 0 || GpuTimers.Timers[id].Count == 0)
+        return 0;
+    const GpuTimer& timer = GpuTimers.Timers[id];
+    return timer.Samples[(timer.Count - 1) % timer.Samples.size()];
+}
+
+void printGpuTimerSummary ()
+{
+    if (GpuTimers.Timers.empty())
+        return;
+    printf("gpu timing: GL_TIME_ELAPSED, results read %d frame(s) late\n", GPU_TIMER_LATENCY-1);
+    for (size_t i=0; i<GpuTimers.Timers.size(); i++) {
+        const GpuTimer& timer = GpuTimers.Timers[i];
+        size_t count = std::min((size_t) timer.Count, timer.Samples.size());
+        printTimingLine(timer.Name, std::vector<float>(timer.Samples.begin(), timer.Samples.begin() + count));
+        if (timer.Dropped)
+            printf("  %-16s    %lld results not ready in time, dropped\n", "", timer.Dropped);
+    }
+}
+
+#endif
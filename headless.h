@@ -0,0 +1,152 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdio.h>
+#include <vector>
+#include <glad/glad.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "gl_resources.h"
+
+/* Rendering without a window or display server : a surfaceless EGL context
+   (Mesa's llvmpipe is enough) drawing into an offscreen framebuffer */
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+struct HeadlessContext {
+    EGLDisplay Display;
+    EGLContext Context;
+} Headless = { EGL_NO_DISPLAY, EGL_NO_CONTEXT };
+
+/* Offscreen framebuffer frames are rendered into when there is no window */
+struct OffscreenTarget {
+    GLFramebuffer Framebuffer;
+    GLRenderbuffer Color;
+    GLRenderbuffer Depth;
+    int Width, Height;
+} Offscreen;
+
+static void* headlessGetProcAddress (const char* name)
+{
+    return (void*) eglGetProcAddress(name);
+}
+
+/* Create a GL 3.3 core context with no surface and load the GL functions.
+   Returns 0 if EGL or the driver can't provide one */
+int initHeadless ()
+{
+    // Prefer Mesa's surfaceless platform, it needs neither X nor a GPU device
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        Headless.Display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (Headless.Display == EGL_NO_DISPLAY)
+        Headless.Display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (Headless.Display == EGL_NO_DISPLAY || !eglInitialize(Headless.Display, &major, &minor)) {
+        fprintf(stderr, "Error: no EGL display for headless rendering\n");
+        return 0;
+    }
+
+    static const EGLint config_attribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    eglChooseConfig(Headless.Display, config_attribs, &config, 1, &num_configs);
+    if (num_configs == 0) {
+        // Surfaceless platforms may only expose configs without any surface type
+        static const EGLint any_surface_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_SURFACE_TYPE, 0, EGL_NONE };
+        eglChooseConfig(Headless.Display, any_surface_attribs, &config, 1, &num_configs);
+    }
+
+    static const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    if (num_configs == 0 || !eglBindAPI(EGL_OPENGL_API) ||
+        (Headless.Context = eglCreateContext(Headless.Display, config, EGL_NO_CONTEXT, context_attribs)) == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Error: could not create a headless OpenGL 3.3 context\n");
+        return 0;
+    }
+
+    // EGL_KHR_surfaceless_context : no surface at all, we only render to framebuffer objects
+    if (!eglMakeCurrent(Headless.Display, EGL_NO_SURFACE, EGL_NO_SURFACE, Headless.Context)) {
+        fprintf(stderr, "Error: surfaceless contexts not supported\n");
+        return 0;
+    }
+
+    gladLoadGLLoader((GLADloadproc) headlessGetProcAddress);
+    printf("EGL %d.%d headless context\n", major, minor);
+    return 1;
+}
+
+void destroyHeadless ()
+{
+    if (Headless.Display == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(Headless.Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (Headless.Context != EGL_NO_CONTEXT)
+        eglDestroyContext(Headless.Display, Headless.Context);
+    eglTerminate(Headless.Display);
+}
+
+/* Create the colour + depth framebuffer frames are drawn into and return its name */
+GLuint createOffscreenTarget (int width, int height)
+{
+    Offscreen.Width = width;
+    Offscreen.Height = height;
+
+    Offscreen.Color = GLRenderbuffer::generate();
+    glBindRenderbuffer(GL_RENDERBUFFER, Offscreen.Color.get());
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    Offscreen.Color.setSize(4LL*width*height);
+
+    Offscreen.Depth = GLRenderbuffer::generate();
+    glBindRenderbuffer(GL_RENDERBUFFER, Offscreen.Depth.get());
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    Offscreen.Depth.setSize(4LL*width*height);
+
+    Offscreen.Framebuffer = GLFramebuffer::generate();
+    glBindFramebuffer(GL_FRAMEBUFFER, Offscreen.Framebuffer.get());
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, Offscreen.Color.get());
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, Offscreen.Depth.get());
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "Error: offscreen framebuffer incomplete\n");
+
+    return Offscreen.Framebuffer.get();
+}
+
+/* Write width x height RGB pixels, stored bottom row first as GL returns them, as a binary PPM */
+int writePPM (const char* path, const unsigned char* rgb, int width, int height)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return 0;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y = height-1; y >= 0; y--)
+        fwrite(rgb + (size_t) y*width*3, 1, (size_t) width*3, file);
+    fclose(file);
+    return 1;
+}
+
+/* Read back the framebuffer and save it; synchronous, meant for occasional dumps */
+void dumpFrame (const char* path, GLuint framebuffer, int width, int height)
+{
+    std::vector<unsigned char> pixels ((size_t) width*height*3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+    if (!writePPM(path, &pixels[0], width, height))
+        fprintf(stderr, "Error: could not write %s\n", path);
+}
+
+#endif
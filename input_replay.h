@@ -0,0 +1,421 @@
+#ifndef INPUT_REPLAY_H
+#define INPUT_REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "level_gen.h"
+#include "frame_pacing.h"
+
+/* Input recording and replay, for repeatable workloads. Recording logs every
+   key, character and mouse button event and every change of the aim cursor
+   with the simulation tick it came in on; replaying feeds the same events to
+   the game at the same ticks in place of GLFW, headless or windowed, so the
+   session plays out the same and only the timing differs between builds.
+   The events carry the game time they were read at, which is what the shot
+   power is made of, and the file starts with the level so the replay plays
+   the same one. At the end the recording stores the score, chances and ball
+   position, and the replay checks it reached them.
+
+   File : "GINP", a version byte, the level, then one record per event : the
+   ticks since the previous record, the type byte and its fields. Integers are
+   LEB128 varints (zigzag when signed), floating point numbers their IEEE bits
+   little endian, so a recording reads the same on any machine. About 5 bytes
+   for a button, 12 for a key and 18 for a cursor sample */
+
+#define INPUT_FILE_MAGIC "GINP"
+#define INPUT_FILE_VERSION 2
+
+enum InputMode { INPUT_LIVE, INPUT_RECORD, INPUT_REPLAY };
+
+enum InputEventType {
+    INPUT_KEY = 1,      // Code key, Action, Mods, Time
+    INPUT_CHAR,         // Code codepoint
+    INPUT_MOUSE,        // Code button, Action, Mods
+    INPUT_CURSOR,       // X, Y : the aim point, in world coordinates
+    INPUT_END           // the session ended : the final state
+};
+
+struct InputEvent {
+    long Tick;
+    int Type;
+    int Code, Action, Mods;
+    double Time;            // game time the event was read at
+    double X, Y;
+};
+
+/* What the session started with and ended on */
+struct InputSession {
+    int Bodies;
+    LevelSpec Level;
+    int Score, Chances;
+    float BallX, BallY;
+};
+
+struct InputReplay {
+    InputMode Mode;
+    const char* Path;
+    FILE* File;             // recording
+    long LastTick;          // of the last record written
+    long long Bytes;
+    InputSession Session;
+
+    std::vector<InputEvent> Events;     // replay : buttons and keys, in order
+    std::vector<InputEvent> Cursor;     // replay : cursor samples, in order
+    size_t NextEvent, NextCursor;
+    long EndTick;                       // tick the recording ended on
+    int Delivering;                     // a replayed event is being handled
+    double EventTime;                   // game time of the event being handled
+    double CursorX, CursorY;            // last cursor sample recorded or replayed
+    int HasCursor;
+
+    std::vector<float> TickTimes;       // simulate() time of every tick, seconds, see recordInputTick
+} Input;
+
+static void putInputVarint (FILE* file, unsigned long value)
+{
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        fputc(byte | (value ? 0x80 : 0), file);
+        Input.Bytes++;
+    } while (value);
+}
+
+static void putInputBytes (FILE* file, const void* data, size_t size)
+{
+    fwrite(data, 1, size, file);
+    Input.Bytes += size;
+}
+
+static int getInputVarint (FILE* file, unsigned long* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF)
+            return 0;
+        *value |= (unsigned long) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+static int getInputBytes (FILE* file, void* data, size_t size)
+{
+    return fread(data, 1, size, file) == size;
+}
+
+/* Signed integers, zigzag so small negatives stay short */
+static void putInputSigned (FILE* file, long value)
+{
+    putInputVarint(file, ((unsigned long) value << 1) ^ (unsigned long) (value >> (8*sizeof(long) - 1)));
+}
+
+static int getInputSigned (FILE* file, long* value)
+{
+    unsigned long zigzag;
+    if (!getInputVarint(file, &zigzag))
+        return 0;
+    *value = (long) (zigzag >> 1) ^ -(long) (zigzag & 1);
+    return 1;
+}
+
+/* size bytes of bits, lowest first */
+static void putInputLittle (FILE* file, uint64_t bits, int size)
+{
+    for (int i=0; i<size; i++)
+        fputc((bits >> 8*i) & 0xff, file);
+    Input.Bytes += size;
+}
+
+static int getInputLittle (FILE* file, uint64_t* bits, int size)
+{
+    *bits = 0;
+    for (int i=0; i<size; i++) {
+        int byte = fgetc(file);
+        if (byte == EOF)
+            return 0;
+        *bits |= (uint64_t) byte << 8*i;
+    }
+    return 1;
+}
+
+static void putInputDouble (FILE* file, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, 8);
+    putInputLittle(file, bits, 8);
+}
+
+static int getInputDouble (FILE* file, double* value)
+{
+    uint64_t bits;
+    if (!getInputLittle(file, &bits, 8))
+        return 0;
+    memcpy(value, &bits, 8);
+    return 1;
+}
+
+static void putInputFloat (FILE* file, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    putInputLittle(file, bits, 4);
+}
+
+static int getInputFloat (FILE* file, float* value)
+{
+    uint64_t bits;
+    if (!getInputLittle(file, &bits, 4))
+        return 0;
+    uint32_t low = bits;
+    memcpy(value, &low, 4);
+    return 1;
+}
+
+/* The level the session played, first thing after the version */
+static void putInputSession (FILE* file, const InputSession& s)
+{
+    putInputSigned(file, s.Bodies);
+    putInputVarint(file, s.Level.Generate);
+    putInputVarint(file, s.Level.Seed);
+    putInputVarint(file, s.Level.Rectangles);
+    putInputVarint(file, s.Level.Targets);
+    putInputVarint(file, s.Level.Obstacles);
+    putInputVarint(file, s.Level.Movers);
+    putInputDouble(file, s.Level.Density);
+    putInputVarint(file, s.Level.Distribution);
+}
+
+static int getInputSession (FILE* file, InputSession& s)
+{
+    long bodies;
+    unsigned long generate, seed, rectangles, targets, obstacles, movers, distribution;
+    if (!getInputSigned(file, &bodies) || !getInputVarint(file, &generate) || !getInputVarint(file, &seed) ||
+        !getInputVarint(file, &rectangles) || !getInputVarint(file, &targets) || !getInputVarint(file, &obstacles) ||
+        !getInputVarint(file, &movers) || !getInputDouble(file, &s.Level.Density) || !getInputVarint(file, &distribution))
+        return 0;
+    s.Bodies = bodies;
+    s.Level.Generate = generate;
+    s.Level.Seed = seed;
+    s.Level.Rectangles = rectangles;
+    s.Level.Targets = targets;
+    s.Level.Obstacles = obstacles;
+    s.Level.Movers = movers;
+    s.Level.Distribution = distribution < LEVEL_DISTRIBUTIONS ? (LevelDistribution) distribution : LEVEL_UNIFORM;
+    return 1;
+}
+
+static void writeInputRecord (long tick, int type)
+{
+    putInputVarint(Input.File, tick - Input.LastTick);
+    fputc(type, Input.File);
+    Input.Bytes++;
+    Input.LastTick = tick;
+}
+
+/* Start recording to path, the session playing bodies objects or the level spec. 0 if it can't be written */
+int startInputRecording (const char* path, int bodies, const LevelSpec& level)
+{
+    Input.File = fopen(path, "wb");
+    if (!Input.File) {
+        fprintf(stderr, "Error: could not write input recording %s\n", path);
+        return 0;
+    }
+    Input.Mode = INPUT_RECORD;
+    Input.Path = path;
+    Input.Session.Bodies = bodies;
+    Input.Session.Level = level;
+    putInputBytes(Input.File, INPUT_FILE_MAGIC, 4);
+    fputc(INPUT_FILE_VERSION, Input.File);
+    putInputSession(Input.File, Input.Session);
+    return 1;
+}
+
+/* Load a recording to replay : the session it played is left in Input.Session
+   for the game to set up. 0 if the file can't be read */
+int startInputReplay (const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    char magic[4];
+    if (!file || !getInputBytes(file, magic, 4) || memcmp(magic, INPUT_FILE_MAGIC, 4) || fgetc(file) != INPUT_FILE_VERSION ||
+        !getInputSession(file, Input.Session)) {
+        fprintf(stderr, "Error: %s is not an input recording\n", path);
+        if (file)
+            fclose(file);
+        return 0;
+    }
+
+    long tick = 0;
+    Input.EndTick = -1;
+    unsigned long delta;
+    while (Input.EndTick < 0 && getInputVarint(file, &delta)) {
+        InputEvent e;
+        memset(&e, 0, sizeof(e));
+        e.Tick = tick += delta;
+        e.Type = fgetc(file);
+        long key, score, chances;
+        unsigned long code;
+        unsigned char fields[3];
+        int ok = 1;
+        switch (e.Type) {
+            case INPUT_KEY:
+                ok = getInputSigned(file, &key) && getInputBytes(file, fields, 2) && getInputDouble(file, &e.Time);
+                e.Code = key, e.Action = fields[0], e.Mods = fields[1];
+                break;
+            case INPUT_CHAR:
+                ok = getInputVarint(file, &code);
+                e.Code = code;
+                break;
+            case INPUT_MOUSE:
+                ok = getInputBytes(file, fields, 3);
+                e.Code = fields[0], e.Action = fields[1], e.Mods = fields[2];
+                break;
+            case INPUT_CURSOR:
+                ok = getInputDouble(file, &e.X) && getInputDouble(file, &e.Y);
+                break;
+            case INPUT_END:
+                ok = getInputSigned(file, &score) && getInputSigned(file, &chances) &&
+                     getInputFloat(file, &Input.Session.BallX) && getInputFloat(file, &Input.Session.BallY);
+                Input.Session.Score = score, Input.Session.Chances = chances;
+                Input.EndTick = tick;
+                break;
+            default:
+                ok = 0;
+        }
+        if (!ok) {
+            fprintf(stderr, "Error: %s is damaged at tick %ld\n", path, tick);
+            break;
+        }
+        if (e.Type == INPUT_CURSOR)
+            Input.Cursor.push_back(e);
+        else if (e.Type != INPUT_END)
+            Input.Events.push_back(e);
+    }
+    fclose(file);
+    if (Input.EndTick < 0) {
+        fprintf(stderr, "Warning: %s has no end, replaying its %ld ticks\n", path, tick);
+        Input.EndTick = tick;
+        Input.Session.Chances = -2;     // nothing to check against
+    }
+    Input.Mode = INPUT_REPLAY;
+    Input.Path = path;
+    Input.TickTimes.reserve(Input.EndTick + 1);
+    printf("Replaying %s : %ld events, %ld cursor samples over %ld ticks\n", path,
+           (long) Input.Events.size(), (long) Input.Cursor.size(), Input.EndTick);
+    return 1;
+}
+
+/* Call first thing in every GLFW input callback, with the game time. Records
+   the event; returns 0 if the game should ignore it : live input during a
+   replay. Input.EventTime is then the time the event happened */
+int acceptInput (long tick, double time, int type, int code, int action=0, int mods=0)
+{
+    if (Input.Mode == INPUT_REPLAY)
+        return Input.Delivering;
+    Input.EventTime = time;
+    if (Input.Mode == INPUT_RECORD) {
+        writeInputRecord(tick, type);
+        if (type == INPUT_CHAR)
+            putInputVarint(Input.File, code);
+        else {
+            unsigned char fields[3] = { (unsigned char) code, (unsigned char) action, (unsigned char) mods };
+            if (type == INPUT_KEY) {
+                putInputSigned(Input.File, code);
+                putInputBytes(Input.File, fields + 1, 2);
+                putInputDouble(Input.File, time);
+            }
+            else
+                putInputBytes(Input.File, fields, 3);
+        }
+    }
+    return 1;
+}
+
+/* The aim cursor read this tick, in world coordinates : recorded when it
+   moved, or replaced with the replayed one */
+void sampleInputCursor (long tick, double* x, double* y)
+{
+    if (Input.Mode == INPUT_REPLAY) {
+        while (Input.NextCursor < Input.Cursor.size() && Input.Cursor[Input.NextCursor].Tick <= tick) {
+            Input.CursorX = Input.Cursor[Input.NextCursor].X;
+            Input.CursorY = Input.Cursor[Input.NextCursor].Y;
+            Input.HasCursor = 1;
+            Input.NextCursor++;
+        }
+        if (Input.HasCursor) {
+            *x = Input.CursorX;
+            *y = Input.CursorY;
+        }
+        return;
+    }
+    if (Input.Mode == INPUT_RECORD && (!Input.HasCursor || *x != Input.CursorX || *y != Input.CursorY)) {
+        writeInputRecord(tick, INPUT_CURSOR);
+        putInputDouble(Input.File, *x);
+        putInputDouble(Input.File, *y);
+    }
+    Input.CursorX = *x;
+    Input.CursorY = *y;
+    Input.HasCursor = 1;
+}
+
+/* The next replayed event due by tick, NULL when there are no more for now.
+   Handle it like the GLFW callback would, with Input.Delivering set */
+const InputEvent* nextReplayedInput (long tick)
+{
+    if (Input.Mode != INPUT_REPLAY || Input.NextEvent == Input.Events.size() || Input.Events[Input.NextEvent].Tick > tick)
+        return NULL;
+    const InputEvent* e = &Input.Events[Input.NextEvent++];
+    Input.EventTime = e->Time;
+    return e;
+}
+
+/* The replay has played all its ticks */
+int inputReplayFinished (long tick)
+{
+    return Input.Mode == INPUT_REPLAY && tick >= Input.EndTick;
+}
+
+/* A tick was simulated in seconds. Kept while Input.TickTimes has room
+   reserved, as replays (and the perf gate) do, so this never allocates */
+static inline void recordInputTick (double seconds)
+{
+    if (Input.TickTimes.size() < Input.TickTimes.capacity())
+        Input.TickTimes.push_back(seconds);
+}
+
+/* The session ended on tick in this state : a recording stores it and closes,
+   a replay checks it against the recording's and prints its timing */
+void finishInput (long tick, int score, int chances, float ball_x, float ball_y)
+{
+    if (Input.Mode == INPUT_RECORD) {
+        writeInputRecord(tick, INPUT_END);
+        putInputSigned(Input.File, score);
+        putInputSigned(Input.File, chances);
+        putInputFloat(Input.File, ball_x);
+        putInputFloat(Input.File, ball_y);
+        fclose(Input.File);
+        printf("Recorded %ld ticks of input to %s, %lld bytes\n", tick, Input.Path, Input.Bytes);
+    }
+    else if (Input.Mode == INPUT_REPLAY) {
+        const InputSession& end = Input.Session;
+        printf("replay: %ld of %ld ticks, %ld of %ld events", tick, Input.EndTick, (long) Input.NextEvent, (long) Input.Events.size());
+        if (tick < Input.EndTick)
+            printf(", stopped early\n");
+        else if (end.Chances == -2)
+            printf(", no final state to check\n");
+        else if (score == end.Score && chances == end.Chances && ball_x == end.BallX && ball_y == end.BallY)
+            printf(", same final state as the recording (score %d)\n", score);
+        else
+            printf(", DIVERGED : score %d chances %d ball %g,%g, recorded %d %d %g,%g\n", score, chances, ball_x, ball_y,
+                   end.Score, end.Chances, end.BallX, end.BallY);
+        printTimingLine("tick", Input.TickTimes);
+    }
+    Input.Mode = INPUT_LIVE;
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef LEVEL_GEN_H
+#define LEVEL_GEN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+/* Level bodies, hand made (levelLayout in game.cpp) or generated from a seed.
+   generateLevel lays out any number of rectangles, targets, obstacles and
+   movers over the play area with a chosen density and spatial distribution.
+   The same LevelSpec gives the same level on every run and every build made
+   with the same C library : the random numbers come straight from mt19937,
+   not from the <random> distributions, whose algorithms aren't specified.
+   levelChecksum fingerprints a level so runs can check they played the same one */
+
+enum LevelBodyKind { BODY_RECTANGLE, BODY_TARGET, BODY_OBSTACLE };
+struct LevelBody {
+    LevelBodyKind kind;
+    double x, y;
+    double length, width;   // rectangles; targets use length as the radius, obstacles as their size
+    double velocity;
+    int translate;
+    // Movers : a rectangle travelling along axis (0 x, 1 y) between moveMin and
+    // moveMax, carrying the target that follows it in the list. Zero for the rest
+    int moveAxis;
+    double moveMin, moveMax;
+};
+
+enum LevelDistribution { LEVEL_UNIFORM, LEVEL_CLUSTERED, LEVEL_GRID, LEVEL_DISTRIBUTIONS };
+static const char* levelDistributionNames[LEVEL_DISTRIBUTIONS] = { "uniform", "clustered", "grid" };
+
+struct LevelSpec {
+    int Generate;           // 0 = play the hand made level
+    unsigned Seed;
+    int Rectangles, Targets, Obstacles, Movers;
+    double Density;         // fraction of the play area the bodies cover, before they shrink to fit
+    LevelDistribution Distribution;
+};
+
+#define LEVEL_DEFAULT_SPEC { 0, 1, 5, 10, 3, 3, 0.08, LEVEL_UNIFORM }
+
+/* Play area : clear of the launcher in the bottom left corner and of the chance markers */
+#define LEVEL_MIN_X -3.2
+#define LEVEL_MAX_X 3.9
+#define LEVEL_MIN_Y -3.7
+#define LEVEL_MAX_Y 3.7
+
+#define LEVEL_CLUSTERS 5
+#define LEVEL_CLUSTER_SPREAD 0.6    // standard deviation around a cluster centre, world units
+#define LEVEL_MOVER_TRACK 1.5       // length of a mover's track at full size
+
+/* Parse a distribution name, -1 if it is unknown */
+int parseLevelDistribution (const char* name)
+{
+    for (int i=0; i<LEVEL_DISTRIBUTIONS; i++)
+        if (!strcmp(name, levelDistributionNames[i]))
+            return i;
+    return -1;
+}
+
+/* A level of about bodies bodies, split like the hand made one : mostly targets
+   and rectangles, a few obstacles and movers (two bodies each) */
+LevelSpec levelSpecForBodies (int bodies, LevelSpec spec)
+{
+    spec.Generate = 1;
+    spec.Movers = bodies/20;
+    spec.Obstacles = bodies/10;
+    spec.Rectangles = bodies*3/10;
+    spec.Targets = std::max(bodies - 2*spec.Movers - spec.Obstacles - spec.Rectangles, 0);
+    return spec;
+}
+
+/* Uniform in [0,1), 53 bits */
+static double levelUnit (std::mt19937& rng)
+{
+    uint32_t a = rng() >> 5, b = rng() >> 6;
+    return (a*67108864.0 + b)/9007199254740992.0;
+}
+
+/* Standard normal, Box-Muller */
+static double levelNormal (std::mt19937& rng)
+{
+    double u = 1 - levelUnit(rng);
+    return sqrt(-2*log(u))*cos(2*M_PI*levelUnit(rng));
+}
+
+/* Anchor points for count bodies, in [0,1)^2 of the play area */
+static void levelPositions (const LevelSpec& spec, int count, std::mt19937& rng, std::vector<double>& u, std::vector<double>& v)
+{
+    u.resize(count);
+    v.resize(count);
+    if (spec.Distribution == LEVEL_GRID) {
+        // Jittered grid, cells handed out in a shuffled order so kinds don't come in rows
+        int side = (int) ceil(sqrt((double) std::max(count, 1)));
+        std::vector<int> cells (side*side);
+        for (size_t i=0; i<cells.size(); i++)
+            cells[i] = i;
+        for (size_t i=cells.size()-1; i>0; i--)
+            std::swap(cells[i], cells[rng() % (i+1)]);
+        for (int i=0; i<count; i++) {
+            u[i] = (cells[i] % side + 0.25 + 0.5*levelUnit(rng))/side;
+            v[i] = (cells[i] / side + 0.25 + 0.5*levelUnit(rng))/side;
+        }
+        return;
+    }
+    double centres[LEVEL_CLUSTERS][2];
+    for (int c=0; c<LEVEL_CLUSTERS; c++) {
+        centres[c][0] = levelUnit(rng);
+        centres[c][1] = levelUnit(rng);
+    }
+    double spread_u = LEVEL_CLUSTER_SPREAD/(LEVEL_MAX_X - LEVEL_MIN_X);
+    double spread_v = LEVEL_CLUSTER_SPREAD/(LEVEL_MAX_Y - LEVEL_MIN_Y);
+    for (int i=0; i<count; i++) {
+        if (spec.Distribution == LEVEL_CLUSTERED) {
+            const double* c = centres[rng() % LEVEL_CLUSTERS];
+            u[i] = std::min(std::max(c[0] + spread_u*levelNormal(rng), 0.0), 0.999);
+            v[i] = std::min(std::max(c[1] + spread_v*levelNormal(rng), 0.0), 0.999);
+        }
+        else {
+            u[i] = levelUnit(rng);
+            v[i] = levelUnit(rng);
+        }
+    }
+}
+
+/* Replace bodies with the level spec describes : rectangles, targets, obstacles, then movers */
+void generateLevel (const LevelSpec& spec, std::vector<LevelBody>& bodies)
+{
+    std::mt19937 rng (spec.Seed);
+    bodies.clear();
+
+    // Shrink everything alike so the bodies cover Density of the area : full size
+    // bodies take 1 x 0.4 (rectangles) or a 0.2 radius circle (targets, obstacles)
+    double circle = M_PI*0.2*0.2;
+    double footprint = spec.Rectangles*0.4 + (spec.Targets + spec.Obstacles)*circle + spec.Movers*(0.4 + circle);
+    double area = (LEVEL_MAX_X - LEVEL_MIN_X)*(LEVEL_MAX_Y - LEVEL_MIN_Y);
+    double scale = footprint > 0 ? std::min(1.0, sqrt(spec.Density*area/footprint)) : 1;
+
+    int anchors = spec.Rectangles + spec.Targets + spec.Obstacles + spec.Movers;
+    std::vector<double> u, v;
+    levelPositions(spec, anchors, rng, u, v);
+
+    // Anchors are bottom left corners for rectangles and centres for circles; keep bodies inside
+    double length = scale, width = 0.4*scale, radius = 0.2*scale, track = LEVEL_MOVER_TRACK*scale;
+    int a = 0;
+    for (int i=0; i<spec.Rectangles; i++, a++) {
+        LevelBody b = { BODY_RECTANGLE, LEVEL_MIN_X + u[a]*(LEVEL_MAX_X - LEVEL_MIN_X - length),
+                        LEVEL_MIN_Y + v[a]*(LEVEL_MAX_Y - LEVEL_MIN_Y - width), length, width, 0, 0, 0, 0, 0 };
+        bodies.push_back(b);
+    }
+    for (int i=0; i<spec.Targets; i++, a++) {
+        LevelBody b = { BODY_TARGET, LEVEL_MIN_X + radius + u[a]*(LEVEL_MAX_X - LEVEL_MIN_X - 2*radius),
+                        LEVEL_MIN_Y + radius + v[a]*(LEVEL_MAX_Y - LEVEL_MIN_Y - 2*radius), radius, 0, 0, 0, 0, 0, 0 };
+        bodies.push_back(b);
+    }
+    for (int i=0; i<spec.Obstacles; i++, a++) {
+        LevelBody b = { BODY_OBSTACLE, LEVEL_MIN_X + length/2 + u[a]*(LEVEL_MAX_X - LEVEL_MIN_X - length),
+                        LEVEL_MIN_Y + length/2 + v[a]*(LEVEL_MAX_Y - LEVEL_MIN_Y - length), length, 0, 0, 0, 0, 0, 0 };
+        bodies.push_back(b);
+    }
+    for (int i=0; i<spec.Movers; i++, a++) {
+        // The track starts at the anchor and runs right or up, room for it and the rider kept
+        int axis = rng() & 1;
+        double x = LEVEL_MIN_X + u[a]*(LEVEL_MAX_X - LEVEL_MIN_X - length - (axis == 0)*track);
+        double y = LEVEL_MIN_Y + v[a]*(LEVEL_MAX_Y - LEVEL_MIN_Y - width - 2*radius - (axis == 1)*track);
+        double start = axis == 0 ? x : y;
+        LevelBody mover = { BODY_RECTANGLE, x, y, length, width, 0.5*scale, 1, axis, start, start + track };
+        LevelBody rider = { BODY_TARGET, x + length/2, y + width + radius, radius, 0, 0.5*scale, 1, 0, 0, 0 };
+        bodies.push_back(mover);
+        bodies.push_back(rider);
+    }
+}
+
+/* FNV-1a over the bodies' fields */
+uint32_t levelChecksum (const std::vector<LevelBody>& bodies)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<bodies.size(); i++) {
+        const LevelBody& b = bodies[i];
+        double fields[] = { (double) b.kind, b.x, b.y, b.length, b.width, b.velocity, (double) b.translate,
+                                                (double) b.moveAxis, b.moveMin, b.moveMax };
+        const unsigned char* bytes = (const unsigned char*) fields;
+        for (size_t k=0; k<sizeof(fields); k++)
+            hash = (hash ^ bytes[k])*16777619u;
+    }
+    return hash;
+}
+
+void printLevelSpec (const LevelSpec& spec, const std::vector<LevelBody>& bodies)
+{
+    printf("level: seed %u, %d rectangles, %d targets, %d obstacles, %d movers, density %.3lf, %s : %ld bodies, checksum %08x\n",
+                  spec.Seed, spec.Rectangles, spec.Targets, spec.Obstacles, spec.Movers, spec.Density,
+                  levelDistributionNames[spec.Distribution], (long) bodies.size(), levelChecksum(bodies));
+}
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdio.h>
+#include <math.h>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+
+/* GPU geometry, kept apart from the game objects drawing it.
+   The shapes the game uses (circles and quads) are generated at compile
+   time, indexed and at unit size, and getMesh() uploads each of them once :
+   objects scale them to their size when drawn, so every target draws from the
+   same buffer whatever its radius */
+
+/* Vertex as stored on the GPU : 2D position and normalized RGBA8 colour, 12 bytes.
+   Build with -DLEGACY_VERTEX_FORMAT for the old separate xyz / rgb float buffers (24 bytes) */
+struct Vertex2D {
+    GLfloat x, y;
+    GLubyte r, g, b, a;
+};
+
+struct Mesh {
+    GLVertexArray VertexArray;
+    GLBuffer VertexBuffer;      // interleaved Vertex2D, or xyz floats with LEGACY_VERTEX_FORMAT
+    GLBuffer ColorBuffer;       // rgb floats, only with LEGACY_VERTEX_FORMAT
+    GLBuffer ElementBuffer;     // 16 bit indices, empty for non indexed meshes
+
+    GLenum PrimitiveMode;
+    GLenum FillMode;
+    int NumVertices;
+    int NumIndices;             // 0 = draw the vertices in order
+    GLfloat Radius;             // distance from the origin to the farthest vertex, for culling
+};
+
+/* Every mesh, cached or not; they live until exit */
+std::vector< std::unique_ptr<Mesh> > Meshes;
+
+/* Upload vertices (xyz floats) and their rgb colours into a new mesh.
+   With index data the primitives are assembled from indices into the vertices */
+Mesh* createMesh (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL,
+                  int numIndices=0, const GLushort* index_buffer_data=NULL)
+{
+    Mesh* mesh = new Mesh;
+    Meshes.push_back(std::unique_ptr<Mesh>(mesh));
+    mesh->PrimitiveMode = primitive_mode;
+    mesh->NumVertices = numVertices;
+    mesh->NumIndices = numIndices;
+    mesh->FillMode = fill_mode;
+    mesh->Radius = 0;
+    for (int i=0; i<numVertices; i++)
+        mesh->Radius = std::max(mesh->Radius, (GLfloat) hypot(vertex_buffer_data[3*i], vertex_buffer_data[3*i + 1]));
+
+    // Create Vertex Array Object
+    // Should be done after CreateWindow and before any other GL calls
+    mesh->VertexArray = GLVertexArray::generate(); // VAO
+    mesh->VertexBuffer = GLBuffer::generate(); // VBO - vertices
+    glBindVertexArray (mesh->VertexArray.get()); // Bind the VAO
+
+#ifdef LEGACY_VERTEX_FORMAT
+    mesh->ColorBuffer = GLBuffer::generate();  // VBO - colors
+
+    bufferData (mesh->VertexBuffer, GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+    glVertexAttribPointer(
+                          0,                  // attribute 0. Vertices
+                          3,                  // size (x,y,z)
+                          GL_FLOAT,           // type
+                          GL_FALSE,           // normalized?
+                          0,                  // stride
+                          (void*)0            // array buffer offset
+                          );
+
+    bufferData (mesh->ColorBuffer, GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
+    glVertexAttribPointer(
+                          1,                  // attribute 1. Color
+                          3,                  // size (r,g,b)
+                          GL_FLOAT,           // type
+                          GL_FALSE,           // normalized?
+                          0,                  // stride
+                          (void*)0            // array buffer offset
+                          );
+#else
+    // Drop z (always 0 in 2D) and pack the colour into 4 bytes, interleaved in one VBO
+    std::vector<Vertex2D> vertices (numVertices);
+    for (int i=0; i<numVertices; i++) {
+        vertices[i].x = vertex_buffer_data[3*i];
+        vertices[i].y = vertex_buffer_data[3*i + 1];
+        vertices[i].r = (GLubyte) (std::min(std::max(color_buffer_data[3*i], 0.0f), 1.0f)*255 + 0.5f);
+        vertices[i].g = (GLubyte) (std::min(std::max(color_buffer_data[3*i + 1], 0.0f), 1.0f)*255 + 0.5f);
+        vertices[i].b = (GLubyte) (std::min(std::max(color_buffer_data[3*i + 2], 0.0f), 1.0f)*255 + 0.5f);
+        vertices[i].a = 255;
+    }
+    bufferData (mesh->VertexBuffer, GL_ARRAY_BUFFER, numVertices*sizeof(Vertex2D), &vertices[0], GL_STATIC_DRAW); // Copy the vertices into VBO
+    glVertexAttribPointer(
+                          0,                  // attribute 0. Vertices
+                          2,                  // size (x,y)
+                          GL_FLOAT,           // type
+                          GL_FALSE,           // normalized?
+                          sizeof(Vertex2D),   // stride
+                          (void*)0            // array buffer offset
+                          );
+    glVertexAttribPointer(
+                          1,                  // attribute 1. Color
+                          4,                  // size (r,g,b,a)
+                          GL_UNSIGNED_BYTE,   // type
+                          GL_TRUE,            // normalized?
+                          sizeof(Vertex2D),   // stride
+                          (void*)offsetof(Vertex2D, r) // array buffer offset
+                          );
+#endif
+
+    // The VAO remembers which attributes are enabled and where they come from
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    // ... and the element buffer bound while it is bound
+    if (numIndices) {
+        mesh->ElementBuffer = GLBuffer::generate();
+        bufferData (mesh->ElementBuffer, GL_ELEMENT_ARRAY_BUFFER, numIndices*sizeof(GLushort), index_buffer_data, GL_STATIC_DRAW);
+    }
+
+    return mesh;
+}
+
+/* sin and cos usable in constant expressions : Taylor series after reducing x to [-pi, pi] */
+constexpr double MESH_PI = 3.14159265358979323846;
+
+constexpr double constexprSin (double x)
+{
+    while (x > MESH_PI)
+        x -= 2*MESH_PI;
+    while (x < -MESH_PI)
+        x += 2*MESH_PI;
+    double term = x, sum = x;
+    for (int n=1; n<12; n++) {
+        term *= -x*x/((2*n)*(2*n+1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double constexprCos (double x)
+{
+    return constexprSin(x + MESH_PI/2);
+}
+
+/* Unit meshes, as unique xyz vertices, their rgb colours and triangle indices, ready for createMesh() */
+template <int NumVertices, int NumIndices>
+struct UnitMesh {
+    GLfloat Vertices[3*NumVertices];
+    GLfloat Colors[3*NumVertices];
+    GLushort Indices[NumIndices];
+};
+
+/* Circle of radius 1 around the origin : a red centre and a rim alternating green
+   and blue, one triangle per segment */
+template <int Segments>
+constexpr UnitMesh<Segments+1, 3*Segments> unitCircle ()
+{
+    UnitMesh<Segments+1, 3*Segments> mesh = {};
+    mesh.Colors[0] = 1;
+    for (int i=0; i<Segments; i++) {
+        double a = 2*MESH_PI*i/Segments;
+        mesh.Vertices[3*(i+1)] = constexprCos(a);
+        mesh.Vertices[3*(i+1) + 1] = constexprSin(a);
+        mesh.Colors[3*(i+1) + (i%2 ? 2 : 1)] = 1;
+        mesh.Indices[3*i] = 0;
+        mesh.Indices[3*i + 1] = i+1;
+        mesh.Indices[3*i + 2] = (i+1)%Segments + 1;
+    }
+    return mesh;
+}
+
+/* Circles come in CIRCLE_LODS levels of detail, picked per object from its size on screen */
+#define CIRCLE_LODS 4
+
+static const int circleLodSegments[CIRCLE_LODS] = { 8, 16, 32, 64 };
+
+constexpr UnitMesh<9, 24> UnitCircle8 = unitCircle<8>();
+constexpr UnitMesh<17, 48> UnitCircle16 = unitCircle<16>();
+constexpr UnitMesh<33, 96> UnitCircle32 = unitCircle<32>();
+constexpr UnitMesh<65, 192> UnitCircle64 = unitCircle<64>();
+
+/* Screen radius, in pixels, above which a level gets too coarse and the next one is used.
+   Level n has circleLodSegments[n] segments; its edges stay within about half a pixel
+   of the true circle up to (segments/pi)^2 pixels of radius */
+static const double circleLodMaxRadius[CIRCLE_LODS-1] = { 6, 26, 104 };
+
+/* Fraction a radius has to move past a boundary before the level changes,
+   so an object sitting on a boundary while zooming doesn't flicker */
+#define CIRCLE_LOD_HYSTERESIS 0.15
+
+struct CircleLodStats {
+    long long Switches;                 // level changes over the session
+    int FrameObjects[CIRCLE_LODS];      // circles drawn at each level since the last resetCircleLodStats
+} CircleLods;
+
+/* Level of detail for a circle radius_pixels wide on screen, currently drawn at level current */
+int selectCircleLod (int current, double radius_pixels)
+{
+    int level = current;
+    while (level < CIRCLE_LODS-1 && radius_pixels > circleLodMaxRadius[level]*(1 + CIRCLE_LOD_HYSTERESIS))
+        level++;
+    while (level > 0 && radius_pixels < circleLodMaxRadius[level-1]*(1 - CIRCLE_LOD_HYSTERESIS))
+        level--;
+    if (level != current)
+        CircleLods.Switches++;
+    CircleLods.FrameObjects[level]++;
+    return level;
+}
+
+void resetCircleLodStats ()
+{
+    for (int i=0; i<CIRCLE_LODS; i++)
+        CircleLods.FrameObjects[i] = 0;
+}
+
+/* [0,1]x[0,1] square split along (0,0)-(1,1), for the rectangles, platform, base, rotator and score digits */
+constexpr UnitMesh<4, 6> UnitQuad = {
+    { 0,0,0,  1,0,0,  1,1,0,  0,1,0 },
+    { 1,0,0,  0,0,1,  0,1,0,  0.3,0.3,0.3 },
+    { 0,1,2,  0,2,3 }
+};
+
+/* The same square around the origin, for the obstacles spinning about their centre */
+constexpr UnitMesh<4, 6> UnitCentredQuad = {
+    { -0.5,-0.5,0,  0.5,-0.5,0,  0.5,0.5,0,  -0.5,0.5,0 },
+    { 1,0,0,  0,0,1,  0,1,0,  0.3,0.3,0.3 },
+    { 0,1,2,  0,2,3 }
+};
+
+enum MeshShape {
+    MESH_CIRCLE,
+    MESH_QUAD,
+    MESH_CENTRED_QUAD
+};
+
+/* What makes two meshes identical : the unit shape at a level of detail */
+struct MeshKey {
+    MeshShape shape;
+    int lod;
+    GLenum fill;
+
+    bool operator< (const MeshKey& other) const {
+        if (shape != other.shape) return shape < other.shape;
+        if (lod != other.lod) return lod < other.lod;
+        return fill < other.fill;
+    }
+};
+
+struct MeshCacheStats {
+    long Requests;
+    long Uploads;
+} MeshStats;
+
+std::map<MeshKey, Mesh*> MeshCache;
+
+template <int NumVertices, int NumIndices>
+static Mesh* createUnitMesh (const UnitMesh<NumVertices, NumIndices>& unit, const MeshKey& key)
+{
+    return createMesh(GL_TRIANGLES, NumVertices, unit.Vertices, unit.Colors, key.fill, NumIndices, unit.Indices);
+}
+
+/* The mesh of a unit shape, uploaded on first use. lod selects the level of detail of circles */
+Mesh* getMesh (MeshShape shape, GLenum fill_mode=GL_FILL, int lod=0)
+{
+    MeshKey key = { shape, shape == MESH_CIRCLE ? lod : 0, fill_mode };
+    MeshStats.Requests++;
+    std::map<MeshKey, Mesh*>::iterator cached = MeshCache.find(key);
+    if (cached != MeshCache.end())
+        return cached->second;
+
+    Mesh* mesh = NULL;
+    switch (shape) {
+        case MESH_CIRCLE:
+            switch (key.lod) {
+                case 0:  mesh = createUnitMesh(UnitCircle8, key); break;
+                case 1:  mesh = createUnitMesh(UnitCircle16, key); break;
+                case 2:  mesh = createUnitMesh(UnitCircle32, key); break;
+                default: mesh = createUnitMesh(UnitCircle64, key); break;
+            }
+            break;
+        case MESH_QUAD:          mesh = createUnitMesh(UnitQuad, key); break;
+        case MESH_CENTRED_QUAD:  mesh = createUnitMesh(UnitCentredQuad, key); break;
+    }
+    MeshStats.Uploads++;
+    MeshCache[key] = mesh;
+    return mesh;
+}
+
+/* The unit circle at level of detail lod, shared by every circle and uploaded the
+   first time one is drawn at that level; afterwards a lookup without the cache's map */
+Mesh* getCircleLod (int lod)
+{
+    static Mesh* lods[CIRCLE_LODS];
+    if (!lods[lod])
+        lods[lod] = getMesh(MESH_CIRCLE, GL_FILL, lod);
+    return lods[lod];
+}
+
+void printMeshStats ()
+{
+    printf("meshes: %ld live, %ld cached shapes, %ld requests, %ld uploads\n",
+           (long) Meshes.size(), (long) MeshCache.size(), MeshStats.Requests, MeshStats.Uploads);
+    printf("circle LOD: %lld level changes, last frame", CircleLods.Switches);
+    for (int i=0; i<CIRCLE_LODS; i++)
+        printf(" %d x %d segments%s", CircleLods.FrameObjects[i], circleLodSegments[i], i < CIRCLE_LODS-1 ? "," : "\n");
+}
+
+#endif
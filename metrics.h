@@ -0,0 +1,424 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "alloc_tracker.h"
+#include "profiler.h"
+
+/* Metrics registry : counters, gauges and histograms, registered once at
+   startup and updated from the game with relaxed atomic stores, never a lock.
+   A publisher thread serves them in the Prometheus text format over HTTP, on
+   a Unix socket or a localhost TCP port, and/or appends a timestamped
+   snapshot to a file every interval for offline runs. The frame loop never
+   waits on a client : formatting, sockets and files are all on that thread.
+   Histograms also get quantiles over the last interval, as <name>_recent.
+   Each metric has one writer thread (the game's main thread); the publisher only reads */
+
+#define METRICS_MAX 48
+#define METRIC_MAX_BUCKETS 16
+#define METRICS_DEFAULT_INTERVAL 10     // seconds between snapshots and recent quantiles
+#define METRICS_REQUEST_TIMEOUT_MS 1000 // a scraper slower than this is dropped
+
+enum MetricType { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+static const char* metricTypeNames[] = { "counter", "gauge", "histogram" };
+
+#define METRIC_QUANTILES 3
+static const double metricQuantiles[METRIC_QUANTILES] = { 0.5, 0.95, 0.99 };
+
+struct Metric {
+    const char* Name;                   // family name, metrics of a family are registered together
+    const char* Labels;                 // "" or e.g. kind="buffers"
+    const char* Help;
+    MetricType Type;
+    double (*Sample) ();                // gauges read by the publisher when it renders, NULL = set by the game
+    std::atomic<double> Value;          // counters and gauges; histograms : sum of observations
+    int Buckets;
+    double Bounds[METRIC_MAX_BUCKETS];  // bucket upper bounds, +Inf after the last
+    std::atomic<uint64_t> Counts[METRIC_MAX_BUCKETS+1];    // per bucket, not cumulative
+
+    // Publisher side : counts at the start of the window, and its quantiles
+    uint64_t WindowStart[METRIC_MAX_BUCKETS+1];
+    double Recent[METRIC_QUANTILES];
+    int HasRecent;
+};
+
+struct MetricsRegistry {
+    Metric Items[METRICS_MAX];
+    int Count;
+
+    // Publisher
+    std::thread Publisher;
+    std::atomic<int> Stopping;
+    int Listen;                         // listening socket, -1 = none
+    std::string SocketPath;             // Unix socket to remove at exit
+    const char* SnapshotPath;
+    double Interval;
+    long long Scrapes, Snapshots;
+} Metrics;
+
+static Metric* registerMetric (const char* name, const char* labels, const char* help, MetricType type)
+{
+    if (Metrics.Count == METRICS_MAX) {
+        fprintf(stderr, "Error: more than %d metrics, %s not registered\n", METRICS_MAX, name);
+        return NULL;
+    }
+    Metric* m = &Metrics.Items[Metrics.Count++];
+    m->Name = name;
+    m->Labels = labels;
+    m->Help = help;
+    m->Type = type;
+    m->Sample = NULL;
+    m->Value.store(0, std::memory_order_relaxed);
+    m->Buckets = 0;
+    for (int i=0; i<=METRIC_MAX_BUCKETS; i++) {
+        m->Counts[i].store(0, std::memory_order_relaxed);
+        m->WindowStart[i] = 0;
+    }
+    m->HasRecent = 0;
+    return m;
+}
+
+Metric* registerCounter (const char* name, const char* help, const char* labels="")
+{
+    return registerMetric(name, labels, help, METRIC_COUNTER);
+}
+
+/* sample : when given, the publisher calls it for the value instead of the game setting it */
+Metric* registerGauge (const char* name, const char* help, const char* labels="", double (*sample) ()=NULL)
+{
+    Metric* m = registerMetric(name, labels, help, METRIC_GAUGE);
+    if (m)
+        m->Sample = sample;
+    return m;
+}
+
+/* bounds : increasing bucket upper bounds, at most METRIC_MAX_BUCKETS */
+Metric* registerHistogram (const char* name, const char* help, const double* bounds, int buckets)
+{
+    Metric* m = registerMetric(name, "", help, METRIC_HISTOGRAM);
+    if (m) {
+        m->Buckets = std::min(buckets, METRIC_MAX_BUCKETS);
+        for (int i=0; i<m->Buckets; i++)
+            m->Bounds[i] = bounds[i];
+    }
+    return m;
+}
+
+/* Updates, from the metric's writer thread. A NULL metric is ignored, so code
+   also run without the registry (the benchmark) can update unconditionally */
+static inline void addCounter (Metric* m, double n=1)
+{
+    if (m)
+        m->Value.store(m->Value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline void setGauge (Metric* m, double value)
+{
+    if (m)
+        m->Value.store(value, std::memory_order_relaxed);
+}
+
+static inline void observeHistogram (Metric* m, double value)
+{
+    if (!m)
+        return;
+    int b = 0;
+    while (b < m->Buckets && value > m->Bounds[b])
+        b++;
+    m->Counts[b].store(m->Counts[b].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m->Value.store(m->Value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/* Process metrics, sampled by the publisher */
+static double sampleResidentBytes ()
+{
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(statm);
+    }
+    return (double) resident*sysconf(_SC_PAGESIZE);
+}
+
+static int64_t metricsStart = profileNow();
+
+static double sampleUptime ()
+{
+    return (profileNow() - metricsStart)*1e-9;
+}
+
+static double sampleHeapAllocations ()
+{
+    return HeapAllocations.Allocations.load(std::memory_order_relaxed);
+}
+
+void registerProcessMetrics ()
+{
+    registerGauge("process_resident_memory_bytes", "Resident set size", "", sampleResidentBytes);
+    registerGauge("game_uptime_seconds", "Time since startup", "", sampleUptime);
+#ifdef TRACK_ALLOCATIONS
+    registerGauge("game_heap_allocations", "Heap allocations since startup", "", sampleHeapAllocations);
+#endif
+}
+
+/* Quantile q of the observations counted in counts, interpolated inside its
+   bucket like Prometheus' histogram_quantile */
+static double histogramQuantile (const Metric* m, const uint64_t* counts, double q)
+{
+    uint64_t total = 0;
+    for (int b=0; b<=m->Buckets; b++)
+        total += counts[b];
+    double rank = q*total, seen = 0;
+    for (int b=0; b<m->Buckets; b++) {
+        if (seen + counts[b] >= rank && counts[b]) {
+            double lower = b ? m->Bounds[b-1] : 0;
+            return lower + (m->Bounds[b] - lower)*(rank - seen)/counts[b];
+        }
+        seen += counts[b];
+    }
+    return m->Buckets ? m->Bounds[m->Buckets-1] : 0;   // in the +Inf bucket
+}
+
+/* Close the window : recent quantiles from what histograms counted since the last call */
+static void updateMetricWindows ()
+{
+    for (int i=0; i<Metrics.Count; i++) {
+        Metric* m = &Metrics.Items[i];
+        if (m->Type != METRIC_HISTOGRAM)
+            continue;
+        uint64_t window[METRIC_MAX_BUCKETS+1], total = 0;
+        for (int b=0; b<=m->Buckets; b++) {
+            uint64_t now = m->Counts[b].load(std::memory_order_relaxed);
+            window[b] = now - m->WindowStart[b];
+            m->WindowStart[b] = now;
+            total += window[b];
+        }
+        m->HasRecent = total > 0;
+        for (int q=0; q<METRIC_QUANTILES && total; q++)
+            m->Recent[q] = histogramQuantile(m, window, metricQuantiles[q]);
+    }
+}
+
+static void appendf (std::string& out, const char* format, ...)
+{
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out.append(line, std::min(n, (int) sizeof(line) - 1));
+}
+
+/* The registry in the Prometheus text exposition format. timestamp_ms > 0 is added to every sample */
+void renderMetrics (std::string& out, long long timestamp_ms=0)
+{
+    char stamp[32] = "";
+    if (timestamp_ms > 0)
+        snprintf(stamp, sizeof(stamp), " %lld", timestamp_ms);
+    for (int i=0; i<Metrics.Count; i++) {
+        const Metric* m = &Metrics.Items[i];
+        if (i == 0 || strcmp(m->Name, Metrics.Items[i-1].Name))
+            appendf(out, "# HELP %s %s\n# TYPE %s %s\n", m->Name, m->Help, m->Name, metricTypeNames[m->Type]);
+        double value = m->Sample ? m->Sample() : m->Value.load(std::memory_order_relaxed);
+        if (m->Type != METRIC_HISTOGRAM) {
+            appendf(out, *m->Labels ? "%s{%s} %.9g%s\n" : "%s%s %.9g%s\n", m->Name, m->Labels, value, stamp);
+            continue;
+        }
+        uint64_t cumulative = 0;
+        for (int b=0; b<=m->Buckets; b++) {
+            cumulative += m->Counts[b].load(std::memory_order_relaxed);
+            if (b < m->Buckets)
+                appendf(out, "%s_bucket{le=\"%.9g\"} %llu%s\n", m->Name, m->Bounds[b], (unsigned long long) cumulative, stamp);
+            else
+                appendf(out, "%s_bucket{le=\"+Inf\"} %llu%s\n", m->Name, (unsigned long long) cumulative, stamp);
+        }
+        appendf(out, "%s_sum %.9g%s\n%s_count %llu%s\n", m->Name, value, stamp, m->Name, (unsigned long long) cumulative, stamp);
+        if (m->HasRecent) {
+            appendf(out, "# HELP %s_recent %s, quantiles over the last %g s\n# TYPE %s_recent gauge\n",
+                    m->Name, m->Help, Metrics.Interval, m->Name);
+            for (int q=0; q<METRIC_QUANTILES; q++)
+                appendf(out, "%s_recent{quantile=\"%g\"} %.9g%s\n", m->Name, metricQuantiles[q], m->Recent[q], stamp);
+        }
+    }
+}
+
+/* Answer one HTTP request on client : GET /metrics (or /) gets the registry */
+static void serveMetricsRequest (int client)
+{
+    struct timeval timeout = { METRICS_REQUEST_TIMEOUT_MS/1000, (METRICS_REQUEST_TIMEOUT_MS%1000)*1000 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[2048];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+        ssize_t n = recv(client, request + length, sizeof(request) - 1 - length, 0);
+        if (n <= 0)
+            break;
+        length += n;
+        request[length] = 0;
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[length] = 0;
+
+    std::string response;
+    if (!strncmp(request, "GET /metrics", 12) || !strncmp(request, "GET / ", 6)) {
+        std::string body;
+        renderMetrics(body);
+        appendf(response, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %ld\r\n\r\n", (long) body.size());
+        response += body;
+        Metrics.Scrapes++;
+    }
+    else
+        response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    for (size_t sent = 0; sent < response.size(); ) {
+        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    close(client);
+}
+
+/* Append the registry to the snapshot file, every sample stamped with the time */
+static void writeMetricsSnapshot ()
+{
+    FILE* file = fopen(Metrics.SnapshotPath, "a");
+    if (!file) {
+        fprintf(stderr, "Error: could not write metrics snapshot %s\n", Metrics.SnapshotPath);
+        return;
+    }
+    long long now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string text;
+    appendf(text, "# snapshot %lld, uptime %.1lf s\n", now_ms, sampleUptime());
+    renderMetrics(text, now_ms);
+    fwrite(text.data(), 1, text.size(), file);
+    fclose(file);
+    Metrics.Snapshots++;
+}
+
+static void metricsPublisherLoop ()
+{
+    setProfileThreadName("metrics");
+    AllocationExemption exempt;     // none of this thread's work is the frame's
+    typedef std::chrono::steady_clock Clock;
+    Clock::duration interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(Metrics.Interval));
+    Clock::time_point next = Clock::now() + interval;
+    while (!Metrics.Stopping.load()) {
+        // Wake up at least every 200 ms to notice stopMetrics
+        long wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+        struct pollfd listen = { Metrics.Listen, POLLIN, 0 };
+        int ready = poll(&listen, Metrics.Listen >= 0 ? 1 : 0, (int) std::max(0L, std::min(wait, 200L)));
+        if (ready > 0 && (listen.revents & POLLIN)) {
+            int client = accept(Metrics.Listen, NULL, NULL);
+            if (client >= 0)
+                serveMetricsRequest(client);
+        }
+        if (Clock::now() >= next) {
+            updateMetricWindows();
+            if (Metrics.SnapshotPath)
+                writeMetricsSnapshot();
+            next += interval;
+        }
+    }
+    updateMetricWindows();
+    if (Metrics.SnapshotPath)
+        writeMetricsSnapshot();
+}
+
+/* Listening socket for endpoint : "unix:PATH", or "PORT" / "localhost:PORT" on 127.0.0.1. -1 on failure */
+static int listenMetrics (const char* endpoint)
+{
+    int fd;
+    if (!strncmp(endpoint, "unix:", 5)) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(endpoint + 5) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "Error: metrics socket path too long\n");
+            return -1;
+        }
+        strcpy(address.sun_path, endpoint + 5);
+        unlink(address.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 4) != 0) {
+            fprintf(stderr, "Error: could not listen on %s : %s\n", endpoint, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        Metrics.SocketPath = address.sun_path;
+        return fd;
+    }
+
+    const char* port = strncmp(endpoint, "localhost:", 10) ? endpoint : endpoint + 10;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // never reachable from other machines
+    address.sin_port = htons(atoi(port));
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    if (fd >= 0)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (fd < 0 || atoi(port) <= 0 || bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 4) != 0) {
+        fprintf(stderr, "Error: could not listen on 127.0.0.1:%s : %s\n", port, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Start publishing : endpoint (NULL = none) and/or snapshots to snapshot_path
+   (NULL = none) every interval seconds. Returns 0 if the endpoint can't be opened */
+int startMetrics (const char* endpoint, const char* snapshot_path, double interval)
+{
+    Metrics.Listen = endpoint ? listenMetrics(endpoint) : -1;
+    if (endpoint && Metrics.Listen < 0)
+        return 0;
+    Metrics.SnapshotPath = snapshot_path;
+    Metrics.Interval = interval > 0 ? interval : METRICS_DEFAULT_INTERVAL;
+    Metrics.Stopping.store(0);
+    Metrics.Publisher = std::thread(metricsPublisherLoop);
+    if (endpoint)
+        printf("Serving metrics on %s\n", endpoint);
+    return 1;
+}
+
+/* Stop the publisher, writing a last snapshot */
+void stopMetrics ()
+{
+    if (!Metrics.Publisher.joinable())
+        return;
+    Metrics.Stopping.store(1);
+    Metrics.Publisher.join();
+    if (Metrics.Listen >= 0)
+        close(Metrics.Listen);
+    if (!Metrics.SocketPath.empty())
+        unlink(Metrics.SocketPath.c_str());
+    printf("metrics: %lld scrapes, %lld snapshots\n", Metrics.Scrapes, Metrics.Snapshots);
+}
+
+#endif
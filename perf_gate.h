@@ -0,0 +1,358 @@
+#ifndef PERF_GATE_H
+#define PERF_GATE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "input_replay.h"
+#include "frame_pacing.h"
+
+/* Performance regression gate, ./bench gate : runs a fixed set of scenes and
+   input replays headless, each in fresh processes like the benchmark, and
+   takes the p50/p95/p99 of its simulation tick times and frame times (draw()
+   and glFinish). The median of a few runs per case is compared with the
+   checked in perf/baseline.json, written the same way, so a noisy run on
+   either side doesn't decide the verdict. A metric regresses when it is slower than its
+   baseline by more than its tolerance, a fraction, and by more than its
+   min_delta, so microsecond ticks don't fail on noise. Prints a table of
+   every metric, optionally writes the result as JSON, and exits with
+   0 : passed, 1 : a metric regressed, 2 : a case or the baseline is broken.
+   --update-baseline rewrites the baseline from this run, keeping tolerances.
+   Timings are only comparable on one machine : keep a baseline per runner */
+
+#define GATE_DEFAULT_RUNS 3
+#define GATE_DEFAULT_BASELINE "perf/baseline.json"
+
+struct GateCase {
+    const char* Name;
+    int Bodies;                 // scenes : body count, 0 = the hand made level
+    int Generated;              // scenes : a generated level of Bodies bodies
+    LevelDistribution Distribution;
+    const char* Replay;         // replays : the recording, the scene comes from it
+    long Frames;                // scenes : frames measured after the warmup
+};
+
+static const GateCase gateCases[] = {
+    { "level",               0,    0, LEVEL_UNIFORM,   NULL,                    300 },
+    { "tiled_1000",          1000, 0, LEVEL_UNIFORM,   NULL,                    300 },
+    { "generated_2000",      2000, 1, LEVEL_CLUSTERED, NULL,                    300 },
+    { "replay_shots",        0,    0, LEVEL_UNIFORM,   "perf/replay_shots.inp", 0 },
+};
+#define GATE_CASES (int) (sizeof(gateCases)/sizeof(gateCases[0]))
+
+/* Measured per case : name, and the default tolerance (tails are noisier) */
+static const char* gateMetricNames[] = { "tick_p50_us", "tick_p95_us", "tick_p99_us", "frame_p50_ms", "frame_p95_ms", "frame_p99_ms" };
+static const double gateDefaultTolerances[] = { 0.25, 0.35, 0.5, 0.25, 0.35, 0.5 };
+static const double gateDefaultMinDeltas[] = { 2, 5, 25, 0.5, 1, 4 };     // in the metric's unit
+#define GATE_METRICS 6
+
+/* Flatten JSON into numbers by path, objects joined with '.', arrays by index :
+   {"cases": {"level": {"tick_p50_us": {"baseline": 3.2}}}} gives
+   cases.level.tick_p50_us.baseline = 3.2. Strings, booleans and null are
+   skipped. Returns 0 on a syntax error */
+static int parseGateJson (const char*& p, const std::string& path, std::map<std::string, double>& numbers)
+{
+    while (isspace((unsigned char) *p))
+        p++;
+    if (*p == '{' || *p == '[') {
+        char close = *p == '{' ? '}' : ']';
+        int index = 0;
+        for (p++; ; index++) {
+            while (isspace((unsigned char) *p))
+                p++;
+            if (*p == close) {
+                p++;
+                return 1;
+            }
+            std::string key;
+            if (close == '}') {
+                if (*p != '"')
+                    return 0;
+                const char* end = strchr(p + 1, '"');
+                if (!end)
+                    return 0;
+                key.assign(p + 1, end);
+                for (p = end + 1; isspace((unsigned char) *p); p++)
+                    ;
+                if (*p++ != ':')
+                    return 0;
+            }
+            else
+                key = std::to_string(index);
+            if (!parseGateJson(p, path.empty() ? key : path + "." + key, numbers))
+                return 0;
+            while (isspace((unsigned char) *p))
+                p++;
+            if (*p == ',')
+                p++;
+            else if (*p != close)
+                return 0;
+        }
+    }
+    if (*p == '"') {
+        for (p++; *p && *p != '"'; p++)
+            if (*p == '\\' && p[1])
+                p++;
+        return *p ? (p++, 1) : 0;
+    }
+    for (const char* word : { "true", "false", "null" })
+        if (!strncmp(p, word, strlen(word))) {
+            p += strlen(word);
+            return 1;
+        }
+    char* end;
+    double value = strtod(p, &end);
+    if (end == p)
+        return 0;
+    numbers[path] = value;
+    p = end;
+    return 1;
+}
+
+/* Child side : set up the case, run it and write "metric value" lines to out */
+static void runGateCase (const GateCase& test, FILE* out)
+{
+    if (!freopen("/dev/null", "w", stdout))
+        fprintf(stderr, "Warning: could not silence stdout\n");
+
+    Options.headless = 1;
+    long frames = BENCH_WARMUP_TICKS + test.Frames;
+    if (test.Replay) {
+        if (!startInputReplay(test.Replay))
+            exit(EXIT_FAILURE);
+        Options.bodies = Input.Session.Bodies;
+        Options.level = Input.Session.Level;
+        frames = Input.EndTick;
+    }
+    else {
+        Options.bodies = test.Bodies;
+        if (test.Generated) {
+            LevelSpec spec = LEVEL_DEFAULT_SPEC;
+            spec.Distribution = test.Distribution;
+            Options.level = levelSpecForBodies(test.Bodies, spec);
+        }
+        Input.TickTimes.reserve(frames);    // recordInputTick keeps the tick times while there is room
+    }
+    window = NULL;
+    if (!initHeadless())
+        exit(EXIT_FAILURE);
+    frame_framebuffer = createOffscreenTarget(width, height);
+    initGL(window, width, height);
+    // Only the game's main loop runs --static-layer auto's timing : the layer stays on here
+
+    std::vector<float> frame_times;
+    frame_times.reserve(frames);
+    while (simulation_tick < frames && chances != -1) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        draw();
+        glFinish();
+        collectGpuTimers();
+        frame_times.push_back(std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count());
+        // A recording's last events are the ones that ended it (Esc, q) : not replayed
+        if (simulation_tick < frames)
+            deliverReplayedInput();
+    }
+
+    // Leave out the warmup : shader compilation, first uploads
+    std::vector<float> ticks (Input.TickTimes.begin() + std::min((size_t) BENCH_WARMUP_TICKS, Input.TickTimes.size()), Input.TickTimes.end());
+    frame_times.erase(frame_times.begin(), frame_times.begin() + std::min((size_t) BENCH_WARMUP_TICKS, frame_times.size()));
+    if (ticks.empty() || frame_times.empty())
+        exit(EXIT_FAILURE);
+    std::sort(ticks.begin(), ticks.end());
+    std::sort(frame_times.begin(), frame_times.end());
+    double values[GATE_METRICS] = { 1e6*framePercentile(ticks, 50), 1e6*framePercentile(ticks, 95), 1e6*framePercentile(ticks, 99),
+                                    1e3*framePercentile(frame_times, 50), 1e3*framePercentile(frame_times, 95),
+                                    1e3*framePercentile(frame_times, 99) };
+    for (int m=0; m<GATE_METRICS; m++)
+        fprintf(out, "%s %.6lf\n", gateMetricNames[m], values[m]);
+}
+
+/* Parent side : run a case in a child, 0 if it failed */
+static int runGateChild (const GateCase& test, double* values)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return 0;
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        FILE* out = fdopen(fds[1], "w");
+        runGateCase(test, out);
+        fclose(out);
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    FILE* in = fdopen(fds[0], "r");
+    char name[64];
+    double value;
+    int found = 0;
+    while (in && fscanf(in, "%63s %lf", name, &value) == 2)
+        for (int m=0; m<GATE_METRICS; m++)
+            if (!strcmp(name, gateMetricNames[m])) {
+                values[m] = value;
+                found++;
+            }
+    if (in)
+        fclose(in);
+    int status = 0;
+    return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0 && found == GATE_METRICS;
+}
+
+static void writeGateBaseline (const char* path, const double results[][GATE_METRICS], const std::map<std::string, double>& old, int runs)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Error: could not write %s\n", path);
+        return;
+    }
+    fprintf(file, "{\n  \"description\": \"./bench gate baseline, median of %d runs; tolerance : allowed slowdown, 0.25 = 25%%, and it must also be over min_delta\",\n  \"cases\": {\n", runs);
+    for (int c=0; c<GATE_CASES; c++) {
+        fprintf(file, "    \"%s\": {\n", gateCases[c].Name);
+        for (int m=0; m<GATE_METRICS; m++) {
+            std::string key = std::string("cases.") + gateCases[c].Name + "." + gateMetricNames[m];
+            std::map<std::string, double>::const_iterator tolerance = old.find(key + ".tolerance");
+            std::map<std::string, double>::const_iterator min_delta = old.find(key + ".min_delta");
+            fprintf(file, "      \"%s\": {\"baseline\": %.3lf, \"tolerance\": %.2lf, \"min_delta\": %.3lf}%s\n",
+                    gateMetricNames[m], results[c][m], tolerance != old.end() ? tolerance->second : gateDefaultTolerances[m],
+                    min_delta != old.end() ? min_delta->second : gateDefaultMinDeltas[m], m+1 < GATE_METRICS ? "," : "");
+        }
+        fprintf(file, "    }%s\n", c+1 < GATE_CASES ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+    fclose(file);
+    printf("Wrote the baseline to %s\n", path);
+}
+
+static void gateUsage (const char* program_name)
+{
+    printf("usage: %s gate [options]\n", program_name);
+    printf("  --baseline PATH      baseline to compare with (default %s)\n", GATE_DEFAULT_BASELINE);
+    printf("  --runs N             runs per case, the median is compared (default %d)\n", GATE_DEFAULT_RUNS);
+    printf("  --report PATH        also write the results and the verdict as JSON to PATH\n");
+    printf("  --update-baseline    write this run's results as the new baseline, keeping its tolerances\n");
+    printf("Exits 0 when no metric regressed, 1 when one did, 2 when a case or the baseline is broken\n");
+}
+
+int perfGateMain (int argc, char** argv)
+{
+    const char* baseline_path = GATE_DEFAULT_BASELINE;
+    const char* report_path = NULL;
+    int runs = GATE_DEFAULT_RUNS, update = 0;
+    for (int i=1; i<argc; i++) {
+        const char* arg = argv[i];
+        int has_value = i+1 < argc;
+        if (!strcmp(arg, "--baseline") && has_value)
+            baseline_path = argv[++i];
+        else if (!strcmp(arg, "--runs") && has_value)
+            runs = max(atoi(argv[++i]), 1);
+        else if (!strcmp(arg, "--report") && has_value)
+            report_path = argv[++i];
+        else if (!strcmp(arg, "--update-baseline"))
+            update = 1;
+        else {
+            gateUsage(argv[0]);
+            return strcmp(arg, "--help") ? 2 : EXIT_SUCCESS;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    std::string text = readFile(baseline_path);
+    const char* p = text.c_str();
+    if (!text.empty() && !parseGateJson(p, "", baseline)) {
+        fprintf(stderr, "Error: %s is not valid JSON near offset %ld\n", baseline_path, (long) (p - text.c_str()));
+        return 2;
+    }
+    if (text.empty() && !update) {
+        fprintf(stderr, "Error: no baseline %s, make one with --update-baseline\n", baseline_path);
+        return 2;
+    }
+
+    // Median run of each metric, both what is compared and what a new baseline keeps
+    double results[GATE_CASES][GATE_METRICS];
+    int broken = 0;
+    for (int c=0; c<GATE_CASES; c++) {
+        std::vector< std::vector<double> > samples (GATE_METRICS);
+        for (int r=0; r<runs; r++) {
+            double values[GATE_METRICS];
+            if (!runGateChild(gateCases[c], values))
+                continue;
+            for (int m=0; m<GATE_METRICS; m++)
+                samples[m].push_back(values[m]);
+        }
+        fprintf(stderr, "%s: %ld of %d runs\n", gateCases[c].Name, (long) samples[0].size(), runs);
+        if (samples[0].empty())
+            broken = 1;
+        for (int m=0; m<GATE_METRICS; m++) {
+            std::sort(samples[m].begin(), samples[m].end());
+            results[c][m] = samples[m].empty() ? -1 : samples[m][samples[m].size()/2];
+        }
+    }
+    if (update) {
+        if (broken) {
+            fprintf(stderr, "Error: a case failed, the baseline is left alone\n");
+            return 2;
+        }
+        writeGateBaseline(baseline_path, results, baseline, runs);
+        return EXIT_SUCCESS;
+    }
+
+    FILE* report = report_path ? fopen(report_path, "w") : NULL;
+    if (report_path && !report)
+        fprintf(stderr, "Error: could not write %s\n", report_path);
+    if (report)
+        fprintf(report, "{\"gate\": \"perf\", \"baseline\": \"%s\", \"runs\": %d, \"metrics\": [", baseline_path, runs);
+
+    int regressed = 0, compared = 0;
+    printf("%-18s %-14s %10s %10s %9s %9s\n", "case", "metric", "baseline", "current", "change", "allowed");
+    for (int c=0; c<GATE_CASES; c++)
+        for (int m=0; m<GATE_METRICS; m++) {
+            std::string key = std::string("cases.") + gateCases[c].Name + "." + gateMetricNames[m];
+            std::map<std::string, double>::const_iterator base = baseline.find(key + ".baseline");
+            std::map<std::string, double>::const_iterator tolerance = baseline.find(key + ".tolerance");
+            std::map<std::string, double>::const_iterator min_delta = baseline.find(key + ".min_delta");
+            double allowed = tolerance != baseline.end() ? tolerance->second : gateDefaultTolerances[m];
+            double floor = min_delta != baseline.end() ? min_delta->second : gateDefaultMinDeltas[m];
+            double current = results[c][m];
+            const char* verdict;
+            double change = 0;
+            if (current < 0)
+                verdict = "FAILED";
+            else if (base == baseline.end() || base->second <= 0)
+                verdict = "no baseline";
+            else {
+                change = current/base->second - 1;
+                compared++;
+                int slower = change > allowed && current - base->second > floor;
+                verdict = slower ? "REGRESSED" : change < -allowed ? "faster" : "ok";
+                regressed += slower;
+            }
+            printf("%-18s %-14s %10.3lf %10.3lf %+8.1lf%% %+8.0lf%%  %s\n", gateCases[c].Name, gateMetricNames[m],
+                   base != baseline.end() ? base->second : 0.0, current, 100*change, 100*allowed, verdict);
+            if (report)
+                fprintf(report, "%s\n  {\"case\": \"%s\", \"metric\": \"%s\", \"baseline\": %.3lf, \"current\": %.3lf, "
+                        "\"tolerance\": %.2lf, \"verdict\": \"%s\"}", c || m ? "," : "", gateCases[c].Name, gateMetricNames[m],
+                        base != baseline.end() ? base->second : 0.0, current, allowed, verdict);
+        }
+
+    int status = broken ? 2 : regressed ? 1 : 0;
+    const char* outcome = broken ? "BROKEN" : regressed ? "FAILED" : "PASSED";
+    printf("perf gate: %s, %d of %d metrics compared, %d regressed\n", outcome, compared, GATE_CASES*GATE_METRICS, regressed);
+    if (report) {
+        fprintf(report, "\n], \"compared\": %d, \"regressed\": %d, \"passed\": %s}\n", compared, regressed, status ? "false" : "true");
+        fclose(report);
+    }
+    return status;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef PERF_OVERLAY_H
+#define PERF_OVERLAY_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "profiler.h"
+#include "frame_pacing.h"
+#include "gpu_timer.h"
+#include "gl_resources.h"
+#include "render_stats.h"
+#include "text.h"
+
+/* On screen performance overlay : fps, a graph of the last frame times, the
+   main thread's profile zones, the GPU pass timers, what the renderer
+   submitted and the live GL objects, all from the previous frame.
+   It is queued as rectangles and text into the text batch, so it adds no
+   draw call of its own and allocates nothing once the batch has grown.
+   recordPerfOverlayFrame runs every frame so the graph is full when the
+   overlay is switched on */
+
+#define PERF_OVERLAY_FRAMES 240         // frames in the graph
+#define PERF_OVERLAY_ZONES 8            // zones listed, the most expensive ones
+#define PERF_OVERLAY_GRAPH_MS 33.3f     // frame time at the top of the graph
+
+struct PerfOverlay {
+    float FrameTimes[PERF_OVERLAY_FRAMES];  // seconds, ring
+    long Frames;                            // recorded so far
+    int64_t FrameStart;                     // profile clock at the last record
+    ProfileZoneTime Zones[PERF_OVERLAY_ZONES*4];
+    int ZoneCount;
+} Overlay;
+
+static bool slowerZone (const ProfileZoneTime& a, const ProfileZoneTime& b)
+{
+    return a.Total > b.Total;
+}
+
+/* Call at the top of every frame, before its first zone opens : takes the
+   frame that just finished */
+void recordPerfOverlayFrame ()
+{
+    int64_t now = profileNow();
+    if (Overlay.FrameStart) {
+        Overlay.FrameTimes[Overlay.Frames % PERF_OVERLAY_FRAMES] = Pacer.LastFrameTime;
+        Overlay.Frames++;
+        Overlay.ZoneCount = sumProfileZones(Overlay.FrameStart, Overlay.Zones, PERF_OVERLAY_ZONES*4);
+        std::sort(Overlay.Zones, Overlay.Zones + Overlay.ZoneCount, slowerZone);
+        Overlay.ZoneCount = std::min(Overlay.ZoneCount, PERF_OVERLAY_ZONES);
+    }
+    Overlay.FrameStart = now;
+}
+
+/* Queue the overlay in the top left corner of a width x height framebuffer,
+   its top at top pixels : under the HUD, clear of the launcher at the bottom */
+void queuePerfOverlay (int width, int height, float top)
+{
+    // 8 pixel cells up to 1000 lines, scaled by whole steps so the font stays crisp
+    float cell = 8*std::max(1, height/1000);
+    float margin = cell;
+    float bar = cell/8;
+    float graph_width = PERF_OVERLAY_FRAMES*bar;
+    float graph_height = 8*cell;
+
+    char text[2048];
+    int n = 0;
+    float fps = Pacer.SmoothedFrameTime > 0 ? 1/Pacer.SmoothedFrameTime : 0;
+    n += snprintf(text + n, sizeof(text) - n, "%.0f fps  %.2f ms  (last %d frames, top %.1f ms)\ncpu zones ms",
+                  fps, 1000*Pacer.SmoothedFrameTime, PERF_OVERLAY_FRAMES, PERF_OVERLAY_GRAPH_MS);
+    for (int i=0; i<Overlay.ZoneCount && n < (int) sizeof(text); i++)
+        n += snprintf(text + n, sizeof(text) - n, "\n  %-18s %7.3f", Overlay.Zones[i].Name, Overlay.Zones[i].Total*1e-6);
+    float gpu_total = 0;
+    for (size_t i=0; i<GpuTimers.Timers.size(); i++)
+        gpu_total += lastGpuTime(i);
+    if (n < (int) sizeof(text))
+        n += snprintf(text + n, sizeof(text) - n, "\ngpu ms %13s %7.3f", "", 1000*gpu_total);
+    for (size_t i=0; i<GpuTimers.Timers.size() && n < (int) sizeof(text); i++)
+        n += snprintf(text + n, sizeof(text) - n, "\n  %-18s %7.3f", GpuTimers.Timers[i].Name, 1000*lastGpuTime(i));
+    long live = 0;
+    for (int i=0; i<GPU_RESOURCE_KINDS; i++)
+        live += GpuResources.live[i];
+    if (n < (int) sizeof(text))
+        n += snprintf(text + n, sizeof(text) - n,
+                      "\ndraw calls %ld  vertices %lld  state changes %ld\n"
+                      "gl objects %ld : vao %ld buf %ld prog %ld tex %ld fbo %ld rbo %ld query %ld",
+                      RenderStats.Last.DrawCalls, RenderStats.Last.Vertices, RenderStats.Last.StateChanges, live,
+                      GpuResources.live[GPU_VERTEX_ARRAY], GpuResources.live[GPU_BUFFER], GpuResources.live[GPU_PROGRAM],
+                      GpuResources.live[GPU_TEXTURE], GpuResources.live[GPU_FRAMEBUFFER], GpuResources.live[GPU_RENDERBUFFER],
+                      GpuResources.live[GPU_QUERY]);
+    int lines = 1;
+    for (const char* c = text; *c; c++)
+        lines += *c == '\n';
+
+    // Panel first : everything after it is drawn over it
+    float panel_width = std::max(graph_width, textWidth(text, cell)) + 2*margin;
+    float panel_height = graph_height + (lines + 1)*cell + 2*margin;
+    float bottom = top - panel_height;
+    queueRectangle(0, bottom, panel_width, panel_height, 0.1, 0.1, 0.1);
+
+    // Frame time graph : one bar per frame, oldest on the left; the line is 60 fps, the top 30
+    float x = margin, y = bottom + margin;
+    float scale = graph_height/PERF_OVERLAY_GRAPH_MS;
+    queueRectangle(x, y, graph_width, graph_height, 0.18, 0.18, 0.18);
+    queueRectangle(x, y + 16.7f*scale, graph_width, 1, 0.4, 0.4, 0.4);
+    long frames = std::min(Overlay.Frames, (long) PERF_OVERLAY_FRAMES);
+    for (long i=0; i<frames; i++) {
+        float ms = 1000*Overlay.FrameTimes[(Overlay.Frames - frames + i) % PERF_OVERLAY_FRAMES];
+        int slow = (ms >= 16.7f) + (ms >= PERF_OVERLAY_GRAPH_MS);   // green, yellow, red
+        queueRectangle(x + (PERF_OVERLAY_FRAMES - frames + i)*bar, y, bar, std::min(ms, PERF_OVERLAY_GRAPH_MS)*scale,
+                       slow ? 1 : 0.3, slow < 2 ? 0.9 : 0.3, 0.3);
+    }
+
+    queueText(x, y + graph_height + lines*cell, cell, 0.9, 0.9, 0.9, text);
+}
+
+#endif
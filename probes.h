@@ -0,0 +1,44 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* Static tracepoints (Linux USDT, <sys/sdt.h> from systemtap-sdt-dev) at the
+   game's main boundaries, for bpftrace or perf to attach to a normal build :
+     game:level_loaded (objects, generated, seed, level checksum)
+     game:frame_start  (frame)
+     game:frame_end    (frame, frame ns start to start, work ns, draw calls)
+     game:tick         (tick, simulate() ns, objects, collision pairs tested)
+     game:contact      (tick, object, PROBE_CONTACT_* side or kind)
+     game:target_hit   (tick, object, score)
+     game:shot_fired   (tick, key hold us, angle millidegrees, chances left)
+   e.g. bpftrace -e 'usdt:./game:game:frame_end { @ms = hist(arg1/1000000) }'
+   A probe is a single nop in the code and a note in the ELF file; its
+   arguments are values already at hand, so untraced it costs nothing
+   measurable. Without sys/sdt.h, or built with -DNO_PROBES, they compile out */
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define GAME_PROBES 1
+#endif
+#endif
+
+#ifdef GAME_PROBES
+#define GAME_PROBE1(name, a) DTRACE_PROBE1(game, name, a)
+#define GAME_PROBE3(name, a, b, c) DTRACE_PROBE3(game, name, a, b, c)
+#define GAME_PROBE4(name, a, b, c, d) DTRACE_PROBE4(game, name, a, b, c, d)
+#else
+#define GAME_PROBE1(name, a)
+#define GAME_PROBE3(name, a, b, c)
+#define GAME_PROBE4(name, a, b, c, d)
+#endif
+
+/* What game:contact reports the ball touched */
+enum ProbeContact {
+    PROBE_CONTACT_TOP = 1,      // of a rectangle
+    PROBE_CONTACT_BOTTOM,
+    PROBE_CONTACT_LEFT,
+    PROBE_CONTACT_RIGHT,
+    PROBE_CONTACT_OBSTACLE
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+/* CPU profiling zones : PROFILE_ZONE("name") times the rest of the enclosing
+   block. Every thread records its zones into its own ring buffer, written
+   without locks or allocation, so recording is always on and cheap (two clock
+   reads and a 24 byte store per zone). writeProfileTrace dumps the last
+   Profiler.Seconds of every thread as Chrome trace-event JSON, which opens in
+   Perfetto (ui.perfetto.dev) or chrome://tracing.
+   Build with -DNO_PROFILER to compile the zones out entirely */
+
+#define PROFILE_RING_EVENTS 65536   // zones kept per thread, a power of two
+#define PROFILE_DEFAULT_SECONDS 5
+
+struct ProfileEvent {
+    const char* Name;           // a string literal, never copied
+    int64_t Start, End;         // steady clock, nanoseconds
+};
+
+/* One thread's ring. Only its own thread writes it; Written is published
+   with release order so a reader on another thread sees complete events */
+struct ProfileThread {
+    int Id;
+    const char* Name;
+    std::atomic<uint64_t> Written;      // events recorded so far
+    ProfileEvent Events[PROFILE_RING_EVENTS];
+};
+
+struct ProfilerState {
+    std::mutex Lock;                        // guards Threads, taken once per thread
+    std::vector<ProfileThread*> Threads;    // never freed : a finished thread's zones stay dumpable
+    double Seconds;                         // how far back a dump reaches
+    long long Dumps;
+} Profiler = { {}, {}, PROFILE_DEFAULT_SECONDS, 0 };
+
+static inline int64_t profileNow ()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* The calling thread's ring, created the first time the thread records */
+static inline ProfileThread* profileThread ()
+{
+    static thread_local ProfileThread* thread = NULL;
+    if (!thread) {
+        thread = new ProfileThread;
+        thread->Name = NULL;
+        thread->Written.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(Profiler.Lock);
+        thread->Id = Profiler.Threads.size() + 1;
+        Profiler.Threads.push_back(thread);
+    }
+    return thread;
+}
+
+/* Name the calling thread in the trace. name must outlive the program (a literal) */
+void setProfileThreadName (const char* name)
+{
+    profileThread()->Name = name;
+}
+
+static inline void recordProfileEvent (const char* name, int64_t start, int64_t end)
+{
+    ProfileThread* thread = profileThread();
+    uint64_t n = thread->Written.load(std::memory_order_relaxed);
+    ProfileEvent& event = thread->Events[n & (PROFILE_RING_EVENTS - 1)];
+    event.Name = name;
+    event.Start = start;
+    event.End = end;
+    thread->Written.store(n + 1, std::memory_order_release);
+}
+
+/* Innermost zone open on this thread, NULL outside any zone. Lets other
+   instrumentation (alloc_tracker.h) charge what happens to the zone doing it */
+static thread_local const char* profileActiveZone = NULL;
+
+class ProfileZone {
+public:
+    explicit ProfileZone (const char* name) : name(name), parent(profileActiveZone), start(profileNow()) { profileActiveZone = name; }
+    ~ProfileZone () {
+        recordProfileEvent(name, start, profileNow());
+        profileActiveZone = parent;
+    }
+    ProfileZone (const ProfileZone&) = delete;
+    ProfileZone& operator= (const ProfileZone&) = delete;
+private:
+    const char* name;
+    const char* parent;
+    int64_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#ifdef NO_PROFILER
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__) (name)
+#endif
+
+/* Total time per zone name of the calling thread's zones that started at or
+   after since, for live displays : no locks, no allocation. Fills at most max
+   entries in order of first appearance (innermost zones first, as they end
+   first); returns how many were filled */
+struct ProfileZoneTime {
+    const char* Name;
+    int64_t Total;      // nanoseconds
+    int Count;
+};
+
+int sumProfileZones (int64_t since, ProfileZoneTime* zones, int max)
+{
+    ProfileThread* thread = profileThread();
+    uint64_t written = thread->Written.load(std::memory_order_relaxed);
+    uint64_t first = written > PROFILE_RING_EVENTS ? written - PROFILE_RING_EVENTS : 0;
+    uint64_t start = written;
+    while (start > first && thread->Events[(start - 1) & (PROFILE_RING_EVENTS - 1)].Start >= since)
+        start--;
+    int n = 0;
+    for (uint64_t i = start; i < written; i++) {
+        const ProfileEvent& e = thread->Events[i & (PROFILE_RING_EVENTS - 1)];
+        int z = 0;
+        while (z < n && zones[z].Name != e.Name)
+            z++;
+        if (z == n) {
+            if (n == max)
+                continue;
+            zones[n].Name = e.Name;
+            zones[n].Total = 0;
+            zones[n].Count = 0;
+            n++;
+        }
+        zones[z].Total += e.End - e.Start;
+        zones[z].Count++;
+    }
+    return n;
+}
+
+/* Copy a thread's events that ended after since. Events the owner overwrote
+   while we were copying are left out */
+static void collectProfileEvents (ProfileThread* thread, int64_t since, std::vector<ProfileEvent>& events)
+{
+    uint64_t written = thread->Written.load(std::memory_order_acquire);
+    uint64_t first = written > PROFILE_RING_EVENTS ? written - PROFILE_RING_EVENTS : 0;
+    size_t base = events.size();
+    for (uint64_t i = first; i < written; i++)
+        events.push_back(thread->Events[i & (PROFILE_RING_EVENTS - 1)]);
+
+    // The owner may have lapped us : slot of index i is rewritten once index i+RING is being written
+    uint64_t now_written = thread->Written.load(std::memory_order_acquire);
+    uint64_t valid = now_written >= PROFILE_RING_EVENTS ? now_written - PROFILE_RING_EVENTS + 1 : 0;
+    size_t skip = valid > first ? std::min((size_t) (valid - first), events.size() - base) : 0;
+    events.erase(events.begin() + base, events.begin() + base + skip);
+    events.erase(std::remove_if(events.begin() + base, events.end(),
+                                [since] (const ProfileEvent& e) { return e.End < since; }), events.end());
+}
+
+/* Write the zones of the last Profiler.Seconds as Chrome trace-event JSON.
+   Returns the number of zones written, -1 if path can't be opened */
+long writeProfileTrace (const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Error: could not write trace %s\n", path);
+        return -1;
+    }
+
+    std::vector<ProfileThread*> threads;
+    {
+        std::lock_guard<std::mutex> lock(Profiler.Lock);
+        threads = Profiler.Threads;
+    }
+    int64_t since = profileNow() - (int64_t) (Profiler.Seconds*1e9);
+    int64_t origin = INT64_MAX;
+    std::vector< std::vector<ProfileEvent> > events (threads.size());
+    for (size_t t=0; t<threads.size(); t++) {
+        collectProfileEvents(threads[t], since, events[t]);
+        for (size_t i=0; i<events[t].size(); i++)
+            origin = std::min(origin, events[t][i].Start);
+    }
+
+    long count = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"game\"}}");
+    for (size_t t=0; t<threads.size(); t++) {
+        const ProfileThread* thread = threads[t];
+        if (thread->Name)
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    thread->Id, thread->Name);
+        // Complete events, timestamps in microseconds
+        for (size_t i=0; i<events[t].size(); i++, count++) {
+            const ProfileEvent& e = events[t][i];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf}",
+                    e.Name, thread->Id, (e.Start - origin)*1e-3, (e.End - e.Start)*1e-3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    Profiler.Dumps++;
+    printf("Wrote %ld profile zones from %ld thread(s), last %.1lf s, to %s\n", count, (long) threads.size(), Profiler.Seconds, path);
+    return count;
+}
+
+#endif
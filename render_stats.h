@@ -0,0 +1,41 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+/* What the renderer submits to GL each frame : draw calls, vertices and state
+   changes (program, vertex array, texture, framebuffer and buffer binds,
+   uniforms, enables and fill modes). The code issuing the GL calls counts
+   them; endRenderStatsFrame keeps the finished frame's totals in Last for the
+   perf overlay */
+
+struct RenderCounts {
+    long DrawCalls;
+    long long Vertices;
+    long StateChanges;
+};
+
+struct RenderStatistics {
+    RenderCounts Frame;     // the frame in progress
+    RenderCounts Last;      // the last finished frame
+} RenderStats;
+
+static inline void countDraw (long long vertices, long instances=1)
+{
+    RenderStats.Frame.DrawCalls++;
+    RenderStats.Frame.Vertices += vertices*instances;
+}
+
+static inline void countStateChanges (long n=1)
+{
+    RenderStats.Frame.StateChanges += n;
+}
+
+/* Call once at the end of every frame */
+void endRenderStatsFrame ()
+{
+    RenderStats.Last = RenderStats.Frame;
+    RenderStats.Frame.DrawCalls = 0;
+    RenderStats.Frame.Vertices = 0;
+    RenderStats.Frame.StateChanges = 0;
+}
+
+#endif
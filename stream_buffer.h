@@ -0,0 +1,156 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stdio.h>
+#include <chrono>
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+
+/* Buffer for data that is rewritten every frame (transforms, instances, ...).
+   With GL_ARB_buffer_storage the buffer is mapped once, persistently, and split
+   into STREAM_SEGMENTS segments used round robin; a fence per segment tells us
+   when the GPU is done reading it. On plain GL 3.3 every frame orphans the
+   buffer and maps it again with glMapBufferRange */
+#define STREAM_SEGMENTS 3
+
+struct StreamBuffer {
+    GLenum Target;
+    GLuint Buffer;
+    GLsizeiptr SegmentSize;
+    int Current;                    // segment being written this frame
+    int Persistent;                 // 1 if mapped with GL_ARB_buffer_storage
+    char* Mapped;                   // persistent mapping of all the segments
+    GLsync Fences[STREAM_SEGMENTS];
+
+    // Statistics, to size the buffer
+    long long Frames;               // segments handed out
+    long long FenceWaits;           // times the CPU had to wait for the GPU
+    double WaitSeconds;             // total time spent waiting
+    int Reallocations;              // times the buffer had to grow
+};
+
+/* Create the GL buffer backing the stream buffer with room for segment_size bytes per frame */
+void allocateStreamBuffer (struct StreamBuffer* sb, GLsizeiptr segment_size)
+{
+    sb->SegmentSize = segment_size;
+    sb->Current = 0;
+    sb->Mapped = NULL;
+    for (int i=0; i<STREAM_SEGMENTS; i++)
+        sb->Fences[i] = 0;
+
+    glGenBuffers (1, &sb->Buffer);
+    gpuResourceCreated(GPU_BUFFER, (sb->Persistent ? STREAM_SEGMENTS : 1)*segment_size);
+    glBindBuffer (sb->Target, sb->Buffer);
+    if (sb->Persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage (sb->Target, STREAM_SEGMENTS*segment_size, NULL, flags);
+        sb->Mapped = (char*) glMapBufferRange (sb->Target, 0, STREAM_SEGMENTS*segment_size, flags);
+    }
+    else
+        glBufferData (sb->Target, segment_size, NULL, GL_STREAM_DRAW);
+}
+
+void initStreamBuffer (struct StreamBuffer* sb, GLenum target, GLsizeiptr segment_size)
+{
+    sb->Target = target;
+    sb->Persistent = GLAD_GL_ARB_buffer_storage ? 1 : 0;
+    sb->Frames = 0;
+    sb->FenceWaits = 0;
+    sb->WaitSeconds = 0;
+    sb->Reallocations = 0;
+    allocateStreamBuffer(sb, segment_size);
+}
+
+void destroyStreamBuffer (struct StreamBuffer* sb)
+{
+    for (int i=0; i<STREAM_SEGMENTS; i++) {
+        if (sb->Fences[i]) {
+            glClientWaitSync (sb->Fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync (sb->Fences[i]);
+        }
+    }
+    glBindBuffer (sb->Target, sb->Buffer);
+    if (sb->Mapped)
+        glUnmapBuffer (sb->Target);
+    glDeleteBuffers (1, &sb->Buffer);
+    gpuResourceDestroyed(GPU_BUFFER, (sb->Persistent ? STREAM_SEGMENTS : 1)*sb->SegmentSize);
+}
+
+/* Make sure a segment can hold size bytes.
+   Returns 1 if the buffer had to be recreated, so anything that refers to
+   sb->Buffer (a buffer texture, a VAO) must be pointed at the new one */
+int reserveStreamBuffer (struct StreamBuffer* sb, GLsizeiptr size)
+{
+    if (size <= sb->SegmentSize)
+        return 0;
+
+    GLsizeiptr segment_size = sb->SegmentSize;
+    while (segment_size < size)
+        segment_size *= 2;
+    destroyStreamBuffer(sb);
+    allocateStreamBuffer(sb, segment_size);
+    sb->Reallocations++;
+    return 1;
+}
+
+/* Get a pointer to size bytes of the buffer for this frame's data.
+   offset receives the byte offset of that data inside sb->Buffer */
+void* mapStreamBuffer (struct StreamBuffer* sb, GLsizeiptr size, GLintptr* offset)
+{
+    sb->Frames++;
+    glBindBuffer (sb->Target, sb->Buffer);
+
+    if (!sb->Persistent) {
+        // Orphan : the driver hands us fresh storage if the old one is still in use
+        *offset = 0;
+        return glMapBufferRange (sb->Target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    }
+
+    // Wait until the GPU has finished with the segment we are about to overwrite
+    GLsync fence = sb->Fences[sb->Current];
+    if (fence) {
+        GLenum status = glClientWaitSync (fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            sb->FenceWaits++;
+            while (status == GL_TIMEOUT_EXPIRED)
+                status = glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+            sb->WaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        glDeleteSync (fence);
+        sb->Fences[sb->Current] = 0;
+    }
+
+    *offset = sb->Current * sb->SegmentSize;
+    return sb->Mapped + *offset;
+}
+
+/* Done writing this frame's data */
+void unmapStreamBuffer (struct StreamBuffer* sb)
+{
+    if (!sb->Persistent) {
+        glBindBuffer (sb->Target, sb->Buffer);
+        glUnmapBuffer (sb->Target);
+    }
+}
+
+/* Call after the draws reading this frame's data have been issued */
+void fenceStreamBuffer (struct StreamBuffer* sb)
+{
+    if (!sb->Persistent)
+        return;
+
+    sb->Fences[sb->Current] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    sb->Current = (sb->Current + 1) % STREAM_SEGMENTS;
+}
+
+void printStreamBufferStats (const char* name, const struct StreamBuffer* sb)
+{
+    printf("%s stream buffer: %s, %ld bytes x %d, %lld frames, %lld fence waits (%.2lf%%, %.3lf ms total), %d reallocations\n",
+           name, sb->Persistent ? "persistent" : "orphaning", (long) sb->SegmentSize,
+           sb->Persistent ? STREAM_SEGMENTS : 1, sb->Frames, sb->FenceWaits,
+           sb->Frames ? 100.0*sb->FenceWaits/sb->Frames : 0.0, sb->WaitSeconds*1000, sb->Reallocations);
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include <glad/glad.h>
+
+#include "gl_resources.h"
+#include "stream_buffer.h"
+#include "font8x8.h"
+#include "render_stats.h"
+
+/* Screen text from a bitmap font. The glyphs are packed once at startup into a
+   one channel atlas texture; every character queued during the frame becomes
+   one instance of a unit quad, and drawQueuedText draws them all with a single
+   instanced draw call. Solid rectangles (queueRectangle) go in the same draw,
+   as instances of an all-set cell, so panels and graphs cost nothing extra.
+   Positions and sizes are in framebuffer pixels, origin at the bottom left
+   like glViewport. Instances are drawn in the order they were queued */
+
+#define TEXT_ATLAS_COLUMNS 16
+#define TEXT_ATLAS_ROWS ((FONT_CHARS + TEXT_ATLAS_COLUMNS - 1) / TEXT_ATLAS_COLUMNS)
+
+/* Texture unit of the atlas, unit 0 holds the object transforms */
+#define TEXT_ATLAS_UNIT 1
+
+/* Instances the batch starts with room for : the perf overlay's graph and
+   readout fit, so turning it on doesn't grow anything mid game */
+#define TEXT_INITIAL_GLYPHS 2048
+
+/* The font's last cell (DEL) is blank; the atlas fills it in for rectangles */
+#define TEXT_SOLID_GLYPH (FONT_CHARS - 1)
+
+/* One character or rectangle on screen, read per instance by Text_GL.vert */
+struct GlyphInstance {
+    GLfloat x, y;           // bottom left corner, pixels
+    GLfloat width, height;  // cell size, pixels
+    GLfloat glyph;          // cell in the atlas
+    GLubyte r, g, b, a;     // colour
+};
+
+struct TextRenderer {
+    GLProgram Program;
+    GLuint ScreenScaleID;   // "ScreenScale" uniform
+    GLuint AtlasCellsID;    // "AtlasCells" uniform
+    GLuint FontID;          // "Font" sampler
+    GLTexture Atlas;
+    GLVertexArray VertexArray;
+    GLBuffer Corners;       // the unit quad, as a triangle strip
+    struct StreamBuffer Instances;
+    std::vector<GlyphInstance> Glyphs;  // queued this frame
+
+    // Statistics
+    long long Draws;
+    long long Characters;
+    int FrameCharacters;    // in the last draw
+} Text;
+
+/* Pack the font into the atlas texture. Rows are uploaded top row first, so t
+   grows downwards through a glyph; Text_GL.vert flips it back */
+void buildFontAtlas ()
+{
+    int atlas_width = TEXT_ATLAS_COLUMNS*FONT_GLYPH_SIZE;
+    int atlas_height = TEXT_ATLAS_ROWS*FONT_GLYPH_SIZE;
+    std::vector<GLubyte> pixels (atlas_width*atlas_height, 0);
+    for (int c=0; c<FONT_CHARS; c++) {
+        int cell_x = (c % TEXT_ATLAS_COLUMNS)*FONT_GLYPH_SIZE;
+        int cell_y = (c / TEXT_ATLAS_COLUMNS)*FONT_GLYPH_SIZE;
+        for (int row=0; row<FONT_GLYPH_SIZE; row++)
+            for (int col=0; col<FONT_GLYPH_SIZE; col++)
+                if (font8x8[c][row] & (1 << col) || c == TEXT_SOLID_GLYPH)
+                    pixels[(cell_y + row)*atlas_width + cell_x + col] = 255;
+    }
+
+    Text.Atlas = GLTexture::generate();
+    glActiveTexture (GL_TEXTURE0 + TEXT_ATLAS_UNIT);
+    glBindTexture (GL_TEXTURE_2D, Text.Atlas.get());
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_R8, atlas_width, atlas_height, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+    glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    Text.Atlas.setSize((long long) atlas_width*atlas_height);
+    glActiveTexture (GL_TEXTURE0);
+}
+
+/* program : linked Text_GL.vert / Text_GL.frag */
+void initText (GLuint program)
+{
+    Text.Program = GLProgram::adopt(program);
+    Text.ScreenScaleID = glGetUniformLocation(program, "ScreenScale");
+    Text.AtlasCellsID = glGetUniformLocation(program, "AtlasCells");
+    Text.FontID = glGetUniformLocation(program, "Font");
+    buildFontAtlas();
+
+    static const GLfloat corners[] = { 0,0, 1,0, 0,1, 1,1 };
+    Text.VertexArray = GLVertexArray::generate();
+    glBindVertexArray (Text.VertexArray.get());
+    Text.Corners = GLBuffer::generate();
+    bufferData (Text.Corners, GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glEnableVertexAttribArray (0);
+    glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, 0, (void*) 0);
+    glEnableVertexAttribArray (1);
+    glVertexAttribDivisor (1, 1);
+    glEnableVertexAttribArray (2);
+    glVertexAttribDivisor (2, 1);
+    glEnableVertexAttribArray (3);
+    glVertexAttribDivisor (3, 1);
+    glBindVertexArray (0);
+
+    initStreamBuffer(&Text.Instances, GL_ARRAY_BUFFER, TEXT_INITIAL_GLYPHS*sizeof(GlyphInstance));
+    Text.Glyphs.reserve(TEXT_INITIAL_GLYPHS);
+    Text.Draws = 0;
+    Text.Characters = 0;
+    Text.FrameCharacters = 0;
+}
+
+/* Width in pixels of the longest line of text drawn with cells of size pixels */
+float textWidth (const char* text, float size)
+{
+    int longest = 0, length = 0;
+    for (const char* c = text; *c; c++) {
+        length = *c == '\n' ? 0 : length + 1;
+        longest = std::max(longest, length);
+    }
+    return longest*size;
+}
+
+/* Queue text with its first line's bottom left corner at (x,y) pixels; '\n' starts a new line below.
+   Characters outside the font are drawn as '?' */
+void queueText (float x, float y, float size, float r, float g, float b, const char* text)
+{
+    GlyphInstance glyph;
+    glyph.x = x;
+    glyph.y = y;
+    glyph.width = size;
+    glyph.height = size;
+    glyph.r = r*255;
+    glyph.g = g*255;
+    glyph.b = b*255;
+    glyph.a = 255;
+    for (const char* c = text; *c; c++) {
+        if (*c == '\n') {
+            glyph.x = x;
+            glyph.y -= size;
+            continue;
+        }
+        int index = (unsigned char) *c - FONT_FIRST_CHAR;
+        if (index < 0 || index >= FONT_CHARS)
+            index = '?' - FONT_FIRST_CHAR;
+        if (index != 0) {   // spaces only advance
+            glyph.glyph = index;
+            Text.Glyphs.push_back(glyph);
+        }
+        glyph.x += size;
+    }
+}
+
+/* Queue a solid rectangle, bottom left corner at (x,y) pixels */
+void queueRectangle (float x, float y, float width, float height, float r, float g, float b)
+{
+    GlyphInstance rectangle;
+    rectangle.x = x;
+    rectangle.y = y;
+    rectangle.width = width;
+    rectangle.height = height;
+    rectangle.glyph = TEXT_SOLID_GLYPH;
+    rectangle.r = r*255;
+    rectangle.g = g*255;
+    rectangle.b = b*255;
+    rectangle.a = 255;
+    Text.Glyphs.push_back(rectangle);
+}
+
+/* printf style queueText */
+void queueTextf (float x, float y, float size, float r, float g, float b, const char* format, ...)
+{
+    char text[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    queueText(x, y, size, r, g, b, text);
+}
+
+/* Draw all the text queued this frame, in one instanced draw, over whatever is in
+   the framebuffer. width, height : framebuffer size in pixels */
+void drawQueuedText (int width, int height)
+{
+    int count = Text.Glyphs.size();
+    Text.FrameCharacters = count;
+    if (count == 0)
+        return;
+
+    GLsizeiptr size = count*sizeof(GlyphInstance);
+    reserveStreamBuffer(&Text.Instances, size);
+    GLintptr offset;
+    void* data = mapStreamBuffer(&Text.Instances, size, &offset);
+    memcpy(data, &Text.Glyphs[0], size);
+    unmapStreamBuffer(&Text.Instances);
+
+    glUseProgram (Text.Program.get());
+    glUniform2f (Text.ScreenScaleID, 2.0f/width, 2.0f/height);
+    glUniform2f (Text.AtlasCellsID, TEXT_ATLAS_COLUMNS, TEXT_ATLAS_ROWS);
+    glActiveTexture (GL_TEXTURE0 + TEXT_ATLAS_UNIT);
+    glBindTexture (GL_TEXTURE_2D, Text.Atlas.get());
+    glUniform1i (Text.FontID, TEXT_ATLAS_UNIT);
+    glActiveTexture (GL_TEXTURE0);
+
+    // The instances sit at a different offset (and maybe buffer) every frame
+    glBindVertexArray (Text.VertexArray.get());
+    glBindBuffer (GL_ARRAY_BUFFER, Text.Instances.Buffer);
+    glVertexAttribPointer (1, 4, GL_FLOAT, GL_FALSE, sizeof(GlyphInstance), (void*) (offset + offsetof(GlyphInstance, x)));
+    glVertexAttribPointer (2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GlyphInstance), (void*) (offset + offsetof(GlyphInstance, r)));
+    glVertexAttribPointer (3, 1, GL_FLOAT, GL_FALSE, sizeof(GlyphInstance), (void*) (offset + offsetof(GlyphInstance, glyph)));
+
+    glDisable (GL_DEPTH_TEST);
+    glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
+    glDrawArraysInstanced (GL_TRIANGLE_STRIP, 0, 4, count);
+    glEnable (GL_DEPTH_TEST);
+    fenceStreamBuffer(&Text.Instances);
+    // program, 4 uniforms, 2 texture unit switches, texture, vertex array, buffer, 3 attributes, 2 enables, fill mode
+    countStateChanges(16);
+    countDraw(4, count);
+
+    Text.Draws++;
+    Text.Characters += count;
+    Text.Glyphs.clear();
+}
+
+void printTextStats ()
+{
+    printf("text: %lld draws, %.1lf characters per draw, %d in the last one\n", Text.Draws,
+           Text.Draws ? (double) Text.Characters/Text.Draws : 0.0, Text.FrameCharacters);
+    printStreamBufferStats("text", &Text.Instances);
+}
+
+#endif